@@ -577,3 +577,19 @@ curve25519_swap_conditional(bignum25519 a, bignum25519 b, uint32_t iswap) {
 	x8 = swap & (a[8] ^ b[8]); a[8] ^= x8; b[8] ^= x8;
 	x9 = swap & (a[9] ^ b[9]); a[9] ^= x9; b[9] ^= x9;
 }
+
+/* out = (flag) ? in : out */
+DONNA_INLINE static void
+curve25519_move_conditional(bignum25519 out, const bignum25519 in, uint32_t flag) {
+	const uint32_t nb = flag - 1, b = ~nb;
+	out[0] = (out[0] & nb) | (in[0] & b);
+	out[1] = (out[1] & nb) | (in[1] & b);
+	out[2] = (out[2] & nb) | (in[2] & b);
+	out[3] = (out[3] & nb) | (in[3] & b);
+	out[4] = (out[4] & nb) | (in[4] & b);
+	out[5] = (out[5] & nb) | (in[5] & b);
+	out[6] = (out[6] & nb) | (in[6] & b);
+	out[7] = (out[7] & nb) | (in[7] & b);
+	out[8] = (out[8] & nb) | (in[8] & b);
+	out[9] = (out[9] & nb) | (in[9] & b);
+}
@@ -407,6 +407,17 @@ curve25519_swap_conditional(bignum25519 a, bignum25519 b, uint64_t iswap) {
 	x4 = swap & (a[4] ^ b[4]); a[4] ^= x4; b[4] ^= x4;
 }
 
+/* out = (flag) ? in : out */
+DONNA_INLINE static void
+curve25519_move_conditional(bignum25519 out, const bignum25519 in, uint64_t flag) {
+	const uint64_t nb = flag - 1, b = ~nb;
+	out[0] = (out[0] & nb) | (in[0] & b);
+	out[1] = (out[1] & nb) | (in[1] & b);
+	out[2] = (out[2] & nb) | (in[2] & b);
+	out[3] = (out[3] & nb) | (in[3] & b);
+	out[4] = (out[4] & nb) | (in[4] & b);
+}
+
 #endif /* ED25519_GCC_64BIT_CHOOSE */
 
 #define ED25519_64BIT_TABLES
@@ -0,0 +1,217 @@
+/*
+	C++20 coroutine verification over ed25519.h
+
+	ed25519::batch_executor collects the signatures awaited by the coroutines
+	of one executor (an event loop thread) and verifies them with a single
+	ed25519_sign_open_batch_ctx:
+
+		ed25519::batch_executor batcher(64, std::chrono::microseconds(200));
+
+		task handle(...) {
+			bool valid = co_await ed25519::verify(pk, sig, m, mlen);
+		}
+
+		// once per event loop iteration, and when batcher.deadline() passes
+		batcher.poll();
+
+	An await suspends the coroutine and links its awaiter (which lives in the
+	coroutine frame) in to the pending batch, so nothing is allocated per
+	await. The batch is verified and every waiter resumed when it reaches the
+	threshold, from inside the await that fills it, or from poll() once the
+	oldest waiter has waited max_latency, or from flush(). Waiters are resumed
+	in the order they arrived, on the executor's thread.
+
+	An executor is not thread safe, every coroutine using it must run on the
+	thread that polls it. verify() without an executor uses the most recently
+	constructed one still alive on the calling thread, or checks the signature
+	right away with ed25519_sign_open if there is none. Executors on a thread
+	may be destroyed in any order.
+*/
+
+#ifndef ED25519_COROUTINE_HPP
+#define ED25519_COROUTINE_HPP
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "ed25519.h"
+
+namespace ed25519 {
+
+class batch_executor;
+
+/* one pending signature, linked in to its executor's batch while suspended */
+class verify_awaiter {
+public:
+	/* executor is nullptr to verify on the spot */
+	verify_awaiter(batch_executor *executor, const unsigned char *pk, const unsigned char *sig, const unsigned char *m, size_t mlen)
+		: executor_(executor), pk_(pk), sig_(sig), m_(m), mlen_(mlen) {}
+
+	bool await_ready() noexcept {
+		if (executor_)
+			return false;
+		valid_ = (ed25519_sign_open(m_, mlen_, pk_, sig_) == 0);
+		return true;
+	}
+	inline bool await_suspend(std::coroutine_handle<> waiter);
+	bool await_resume() const noexcept { return valid_; }
+
+private:
+	friend class batch_executor;
+
+	batch_executor *executor_;
+	const unsigned char *pk_, *sig_, *m_;
+	size_t mlen_;
+	std::coroutine_handle<> waiter_;
+	verify_awaiter *next_ = nullptr;
+	bool valid_ = false;
+};
+
+class batch_executor {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	/* at most max_batch (64) signatures per batch, 0 for 64 */
+	explicit batch_executor(size_t max_batch = max_batch_size, clock::duration max_latency = std::chrono::microseconds(200))
+		: threshold_((!max_batch || (max_batch > max_batch_size)) ? max_batch_size : max_batch), max_latency_(max_latency) {
+		size_t size = ed25519_batch_context_size();
+		memory_ = std::malloc(size);
+		ctx_ = ed25519_batch_context_init(memory_, size);
+		if (!ctx_) {
+			std::free(memory_);
+			throw std::bad_alloc();
+		}
+		previous_ = current_;
+		if (previous_)
+			previous_->newer_ = this;
+		current_ = this;
+	}
+
+	/* unlinks from the thread's executors wherever it is among them */
+	~batch_executor() {
+		flush();
+		if (newer_)
+			newer_->previous_ = previous_;
+		else
+			current_ = previous_;
+		if (previous_)
+			previous_->newer_ = newer_;
+		std::free(memory_);
+	}
+
+	batch_executor(const batch_executor &) = delete;
+	batch_executor &operator=(const batch_executor &) = delete;
+
+	/* the executor verify() uses on this thread, nullptr if there is none */
+	static batch_executor *current() noexcept { return current_; }
+
+	verify_awaiter verify(const unsigned char *pk, const unsigned char *sig, const unsigned char *m, size_t mlen) {
+		return verify_awaiter(this, pk, sig, m, mlen);
+	}
+
+	size_t pending() const noexcept { return count_; }
+
+	/* when poll() will next flush, clock::time_point::max() with nothing pending */
+	clock::time_point deadline() const noexcept {
+		return count_ ? (oldest_ + max_latency_) : clock::time_point::max();
+	}
+
+	/* flushes if the oldest waiter has waited max_latency, returns the number resumed */
+	size_t poll() {
+		return (count_ && (clock::now() >= deadline())) ? flush() : 0;
+	}
+
+	/* verifies and resumes every pending waiter, returns the number resumed */
+	size_t flush() { return run(nullptr); }
+
+private:
+	friend class verify_awaiter;
+
+	static constexpr size_t max_batch_size = 64;
+
+	/* links awaiter in, returns false when it filled the batch and has its result already */
+	bool add(verify_awaiter *awaiter) {
+		if (!count_)
+			oldest_ = clock::now();
+		if (tail_)
+			tail_->next_ = awaiter;
+		else
+			head_ = awaiter;
+		tail_ = awaiter;
+		if (++count_ < threshold_)
+			return true;
+		run(awaiter);
+		return false;
+	}
+
+	/*
+		the batch is unlinked before anything is resumed, so resumed coroutines can
+		await again in to a new batch. self is the awaiter that filled the batch, it
+		carries on without being resumed
+	*/
+	size_t run(verify_awaiter *self) {
+		const unsigned char *m[max_batch_size], *pk[max_batch_size], *sig[max_batch_size];
+		size_t mlen[max_batch_size];
+		int valid[max_batch_size];
+		verify_awaiter *first = head_, *awaiter, *next;
+		size_t count = count_, i;
+
+		if (!count)
+			return 0;
+		head_ = tail_ = nullptr;
+		count_ = 0;
+
+		for (i = 0, awaiter = first; awaiter; awaiter = awaiter->next_, i++) {
+			m[i] = awaiter->m_;
+			mlen[i] = awaiter->mlen_;
+			pk[i] = awaiter->pk_;
+			sig[i] = awaiter->sig_;
+		}
+		ed25519_sign_open_batch_ctx(ctx_, m, mlen, pk, sig, count, valid);
+
+		/* next is read before the resume, which may destroy the awaiter */
+		for (i = 0, awaiter = first; awaiter; awaiter = next, i++) {
+			next = awaiter->next_;
+			awaiter->valid_ = (valid[i] != 0);
+			if (awaiter != self)
+				awaiter->waiter_.resume();
+		}
+		return count;
+	}
+
+	size_t threshold_;
+	clock::duration max_latency_;
+	clock::time_point oldest_;
+	verify_awaiter *head_ = nullptr, *tail_ = nullptr;
+	size_t count_ = 0;
+	void *memory_;
+	ed25519_batch_context *ctx_;
+	/* the executors alive on the constructing thread, oldest first */
+	batch_executor *previous_, *newer_ = nullptr;
+
+	static inline thread_local batch_executor *current_ = nullptr;
+};
+
+inline bool
+verify_awaiter::await_suspend(std::coroutine_handle<> waiter) {
+	waiter_ = waiter;
+	return executor_->add(this);
+}
+
+/* co_await verify(...) is true for a valid signature */
+inline verify_awaiter
+verify(batch_executor &executor, const unsigned char *pk, const unsigned char *sig, const unsigned char *m, size_t mlen) {
+	return executor.verify(pk, sig, m, mlen);
+}
+
+/* uses batch_executor::current(), or ed25519_sign_open when there is no executor */
+inline verify_awaiter
+verify(const unsigned char *pk, const unsigned char *sig, const unsigned char *m, size_t mlen) {
+	return verify_awaiter(batch_executor::current(), pk, sig, m, mlen);
+}
+
+} /* namespace ed25519 */
+
+#endif /* ED25519_COROUTINE_HPP */
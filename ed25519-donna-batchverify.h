@@ -2,274 +2,581 @@
 	Ed25519 batch verification
 */
 
-#define max_batch_size 64
-#define heap_batch_size ((max_batch_size * 2) + 1)
-
-/* which limb is the 128th bit in? */
-static const size_t limb128bits = (128 + bignum256modm_bits_per_limb - 1) / bignum256modm_bits_per_limb;
+/*
+	everything a batch needs beyond a few hundred bytes of stack, so verification
+	can run from caller owned memory on small stacks. the entry points without a
+	context allocate one
+*/
+struct ed25519_batch_context_t {
+	batch_heap ALIGN(64) batch;
+	ge25519_msm_scratch ALIGN(64) scratch; /* batch.scratch, for the budget fallback */
+	size_t sig_index[max_batch_size], key_index[max_batch_size];
+	const unsigned char *key_pk[max_batch_size], *sig_RS[max_batch_size];
+	unsigned char hram[max_batch_size][64];
+
+	/* per window messages for ed25519_sign_open_batch_windows */
+	ed25519_dom2 dom[max_batch_size];
+	ed25519_iovec segment[max_batch_size];
+	const ed25519_iovec *iov[max_batch_size];
+	size_t iovcnt[max_batch_size];
+
+	/* per window keys and signatures for ed25519_sign_open_batch_prepared */
+	const unsigned char *prepared_pk[max_batch_size], *prepared_RS[max_batch_size];
+};
+
+/* the first 64 byte boundary in memory, NULL if size bytes from there don't fit in len */
+static void *
+ed25519_batch_align(void *memory, size_t len, size_t size) {
+	size_t skip = (size_t)((64 - ((uintptr_t)memory & 63)) & 63);
+	if (!memory || (len < skip) || ((len - skip) < size))
+		return NULL;
+	return (unsigned char *)memory + skip;
+}
 
-typedef size_t heap_index_t;
+size_t
+ED25519_FN(ed25519_batch_context_size) (void) {
+	return sizeof(ed25519_batch_context) + 63;
+}
 
-typedef struct batch_heap_t {
-	unsigned char r[heap_batch_size][16]; /* 128 bit random values */
-	ge25519 points[heap_batch_size];
-	bignum256modm scalars[heap_batch_size];
-	heap_index_t heap[heap_batch_size];
-	size_t size;
-} batch_heap;
+ed25519_batch_context *
+ED25519_FN(ed25519_batch_context_init) (void *memory, size_t len) {
+	ed25519_batch_context *ctx = (ed25519_batch_context *)ed25519_batch_align(memory, len, sizeof(ed25519_batch_context));
+	if (ctx)
+		ctx->batch.scratch = &ctx->scratch;
+	return ctx;
+}
 
-/* swap two values in the heap */
-static void
-heap_swap(heap_index_t *heap, size_t a, size_t b) {
-	heap_index_t temp;
-	temp = heap[a];
-	heap[a] = heap[b];
-	heap[b] = temp;
+/*
+	a context from the heap for the entry points without one, which keeps them to a few
+	hundred bytes of stack. NULL if the allocation fails, *memory is for free either way
+*/
+static ed25519_batch_context *
+ed25519_batch_context_alloc(void **memory) {
+	size_t size = ED25519_FN(ed25519_batch_context_size) ();
+	*memory = malloc(size);
+	return ED25519_FN(ed25519_batch_context_init) (*memory, size);
 }
 
-/* add the scalar at the end of the list to the heap */
-static void
-heap_insert_next(batch_heap *heap) {
-	size_t node = heap->size, parent;
-	heap_index_t *pheap = heap->heap;
-	bignum256modm *scalars = heap->scalars;
-
-	/* insert at the bottom */
-	pheap[node] = (heap_index_t)node;
-
-	/* sift node up to its sorted spot */
-	parent = (node - 1) / 2;
-	while (node && lt256_modm_batch(scalars[pheap[parent]], scalars[pheap[node]], bignum256modm_limb_size - 1)) {
-		heap_swap(pheap, parent, node);
-		node = parent;
-		parent = (node - 1) / 2;
-	}
-	heap->size++;
+/* without a context nothing is verified, so every signature is reported invalid */
+static int
+ed25519_batch_none_valid(int *valid, size_t num) {
+	size_t i;
+	for (i = 0; i < num; i++)
+		valid[i] = 0;
+	return num ? 1 : 0;
 }
 
-/* update the heap when the root element is updated */
-static void
-heap_updated_root(batch_heap *heap, size_t limbsize) {
-	size_t node, parent, childr, childl;
-	heap_index_t *pheap = heap->heap;
-	bignum256modm *scalars = heap->scalars;
-
-	/* sift root to the bottom */
-	parent = 0;
-	node = 1;
-	childl = 1;
-	childr = 2;
-	while ((childr < heap->size)) {
-		node = lt256_modm_batch(scalars[pheap[childl]], scalars[pheap[childr]], limbsize) ? childr : childl;
-		heap_swap(pheap, parent, node);
-		parent = node;
-		childl = (parent * 2) + 1;
-		childr = childl + 1;
+/*
+	checks a batch once its points are in place, the keys at points[1..keys] and -R at
+	points[keys+1..keys+batchsize]. signature i is RS[i] with hash hram[i] under key
+	key_index[i]. returns 1 if every signature is valid, 0 if at least one is not
+*/
+static int
+ed25519_batch_check(batch_heap *batch, unsigned char (*hram)[64], const unsigned char **RS, const size_t *key_index, size_t keys, size_t batchsize) {
+	ge25519 ALIGN(16) p;
+	bignum256modm *r_scalars, scalar;
+	size_t i;
+
+	/* generate r (scalars[keys+1]..scalars[keys+batchsize] */
+	ED25519_FN(ed25519_randombytes_unsafe) (batch->r, batchsize * 16);
+	r_scalars = &batch->scalars[keys + 1];
+	for (i = 0; i < batchsize; i++)
+		expand256_modm(r_scalars[i], batch->r[i], 16);
+
+	/* compute scalars[0] = ((r1s1 + r2s2 + ...)) */
+	memset(&batch->scalars[0], 0, sizeof(bignum256modm));
+	for (i = 0; i < batchsize; i++) {
+		expand256_modm(scalar, RS[i] + 32, 32);
+		mul256_modm(scalar, scalar, r_scalars[i]);
+		add256_modm(batch->scalars[0], batch->scalars[0], scalar);
 	}
 
-	/* sift root back up to its sorted spot */
-	parent = (node - 1) / 2;
-	while (node && lte256_modm_batch(scalars[pheap[parent]], scalars[pheap[node]], limbsize)) {
-		heap_swap(pheap, parent, node);
-		node = parent;
-		parent = (node - 1) / 2;
+	/* compute scalars[1]..scalars[keys] as the sums of r[i]*H(R[i],A[i],m[i]) for each key */
+	memset(&batch->scalars[1], 0, keys * sizeof(bignum256modm));
+	for (i = 0; i < batchsize; i++) {
+		expand256_modm(scalar, hram[i], 64);
+		mul256_modm(scalar, scalar, r_scalars[i]);
+		add256_modm(batch->scalars[key_index[i] + 1], batch->scalars[key_index[i] + 1], scalar);
 	}
-}
 
-/* build the heap with count elements, count must be >= 3 */
-static void
-heap_build(batch_heap *heap, size_t count) {
-	heap->heap[0] = 0;
-	heap->size = 0;
-	while (heap->size < count)
-		heap_insert_next(heap);
+	/* the full size scalars build the heap, the 128 bit r scalars are added later */
+	batch->points[0] = ge25519_basepoint;
+	ge25519_multi_scalarmult_boscoster_vartime(&p, batch, (keys + 1) | 1, keys + batchsize + 1);
+#if defined(ED25519_COFACTORED)
+	/* the random r would otherwise scale small order components unpredictably */
+	ge25519_double_partial(&p, &p);
+	ge25519_double_partial(&p, &p);
+	ge25519_double_partial(&p, &p);
+#endif
+	return ge25519_is_neutral_vartime(&p);
 }
 
-/* extend the heap to contain new_count elements */
+/*
+	remembers a signature from a batch that passed. only in cofactored mode does that settle
+	it alone: the cofactorless batch also accepts what ed25519_sign_open turns away, such as
+	R in a non canonical encoding, so there only the single checks are remembered
+*/
 static void
-heap_extend(batch_heap *heap, size_t new_count) {
-	while (heap->size < new_count)
-		heap_insert_next(heap);
+ed25519_batch_cache_valid(const unsigned char hram[64], const unsigned char *RS) {
+#if defined(ED25519_COFACTORED)
+	ed25519_verify_cache_insert(hram, RS, 0);
+#else
+	(void)hram; (void)RS;
+#endif
 }
 
-/* get the top 2 elements of the heap */
-static void
-heap_get_top2(batch_heap *heap, heap_index_t *max1, heap_index_t *max2, size_t limbsize) {
-	heap_index_t h0 = heap->heap[0], h1 = heap->heap[1], h2 = heap->heap[2];
-	if (lt256_modm_batch(heap->scalars[h1], heap->scalars[h2], limbsize))
-		h1 = h2;
-	*max1 = h0;
-	*max2 = h1;
-}
+/*
+	the curve stage of a window: ctx->hram[i] holds the hash of signature sig_index[i] for
+	the batchsize signatures still to check. sets their valid entries, returns 0 if all
+	are valid
+*/
+static int
+ed25519_batch_verify_hashed(ed25519_batch_context *ctx, const unsigned char **pk, const unsigned char **RS, size_t batchsize, int *valid) {
+	batch_heap *batch = &ctx->batch;
+	size_t i, j, k, keys;
+	size_t *sig_index = ctx->sig_index, *key_index = ctx->key_index;
+	const unsigned char **key_pk = ctx->key_pk;
+	unsigned char (*hram)[64] = ctx->hram;
+	int ret = 0;
 
-/* */
-static void
-ge25519_multi_scalarmult_vartime_final(ge25519 *r, ge25519 *point, bignum256modm scalar) {
-	const bignum256modm_element_t topbit = ((bignum256modm_element_t)1 << (bignum256modm_bits_per_limb - 1));
-	size_t limb = limb128bits;
-	bignum256modm_element_t flag;
-
-	if (isone256_modm_batch(scalar)) {
-		/* this will happen most of the time after bos-carter */
-		*r = *point;
-		return;
-	} else if (iszero256_modm_batch(scalar)) {
-		/* this will only happen if all scalars == 0 */
-		memset(r, 0, sizeof(*r));
-		r->y[0] = 1;
-		r->z[0] = 1;
-		return;
+	if (batchsize <= 3)
+		goto fallback;
+
+	/* find the distinct public keys, signatures by the same key share a point */
+	for (i = 0, keys = 0; i < batchsize; i++) {
+		for (k = 0; k < keys; k++)
+			if ((key_pk[k] == pk[sig_index[i]]) || (memcmp(key_pk[k], pk[sig_index[i]], 32) == 0))
+				break;
+		if (k == keys)
+			key_pk[keys++] = pk[sig_index[i]];
+		key_index[i] = k;
 	}
 
-	*r = *point;
+	/* compute points */
+	for (k = 0; k < keys; k++)
+		if (!ed25519_unpack_key_vartime(&batch->points[k+1], NULL, key_pk[k]))
+			goto fallback;
+	for (i = 0; i < batchsize; i++) {
+		ctx->sig_RS[i] = RS[sig_index[i]];
+		if (!ge25519_unpack_negative_vartime(&batch->points[keys+i+1], RS[sig_index[i]]))
+			goto fallback;
+	}
 
-	/* find the limb where first bit is set */
-	while (!scalar[limb])
-		limb--;
+	if (!ed25519_batch_check(batch, hram, ctx->sig_RS, key_index, keys, batchsize)) {
+		ret |= 2;
 
-	/* find the first bit */
-	flag = topbit;
-	while ((scalar[limb] & flag) == 0)
-		flag >>= 1;
+		fallback:
+		for (i = 0; i < batchsize; i++) {
+			j = sig_index[i];
+			valid[j] = ed25519_sign_open_hram(hram[i], pk[j], RS[j]) ? 0 : 1;
+			ret |= (valid[j] ^ 1);
+		}
+	} else {
+		for (i = 0; i < batchsize; i++)
+			ed25519_batch_cache_valid(hram[i], RS[sig_index[i]]);
+	}
+	return ret;
+}
 
-	/* exponentiate */
-	for (;;) {
-		ge25519_double(r, r);
-		if (scalar[limb] & flag)
-			ge25519_add(r, r, point);
+/* dom is NULL for plain Ed25519, or holds dom2 for each signature */
+static int
+ed25519_sign_open_batch_dom2(ed25519_batch_context *ctx, const ed25519_dom2 *dom, const ed25519_iovec **iov, const size_t *iovcnt, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	size_t i, windowsize, batchsize;
+	size_t *sig_index = ctx->sig_index;
+	unsigned char (*hram)[64] = ctx->hram;
+	int ret = 0, result;
+
+	while (num > 0) {
+		windowsize = (num > max_batch_size) ? max_batch_size : num;
+
+		/* signatures with a remembered result are settled now, the rest go in the batch */
+		for (i = 0, batchsize = 0; i < windowsize; i++) {
+			/* the next R, A and start of m are fetched while this signature is hashed */
+			if ((i + 1) < windowsize) {
+				DONNA_PREFETCH(RS[i + 1]);
+				DONNA_PREFETCH(pk[i + 1]);
+				if (iovcnt[i + 1])
+					DONNA_PREFETCH(iov[i + 1][0].iov_base);
+			}
 
-		flag >>= 1;
-		if (!flag) {
-			if (!limb--)
-				break;
-			flag = topbit;
+			valid[i] = 1;
+			/* S is range checked here, the batch equation only sees S mod l */
+			if (ed25519_signature_s_invalid(RS[i]) || (dom && (dom[i].ctxlen > 255))) {
+				valid[i] = 0;
+				ret |= 1;
+				continue;
+			}
+			ed25519_hram_iov(hram[batchsize], dom ? &dom[i] : NULL, RS[i], pk[i], iov[i], iovcnt[i]);
+			if (ed25519_verify_cache_find(&result, hram[batchsize], RS[i])) {
+				valid[i] = result ? 0 : 1;
+				ret |= (valid[i] ^ 1);
+			} else {
+				sig_index[batchsize++] = i;
+			}
 		}
+
+		ret |= ed25519_batch_verify_hashed(ctx, pk, RS, batchsize, valid);
+
+		if (dom)
+			dom += windowsize;
+		iov += windowsize;
+		iovcnt += windowsize;
+		pk += windowsize;
+		RS += windowsize;
+		num -= windowsize;
+		valid += windowsize;
 	}
+
+	return ret;
 }
 
-/* count must be >= 5 */
-static void
-ge25519_multi_scalarmult_vartime(ge25519 *r, batch_heap *heap, size_t count) {
-	heap_index_t max1, max2;
+int
+ED25519_FN(ed25519_sign_open_batch_iov_ctx) (ed25519_batch_context *ctx, const ed25519_iovec **iov, const size_t *iovcnt, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	return ed25519_sign_open_batch_dom2(ctx, NULL, iov, iovcnt, pk, RS, num, valid);
+}
 
-	/* start with the full limb size */
-	size_t limbsize = bignum256modm_limb_size - 1;
+int
+ED25519_FN(ed25519_sign_open_batch_iov) (const ed25519_iovec **iov, const size_t *iovcnt, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	void *memory;
+	ed25519_batch_context *ctx = ed25519_batch_context_alloc(&memory);
+	int ret = ctx ? ed25519_sign_open_batch_dom2(ctx, NULL, iov, iovcnt, pk, RS, num, valid) : ed25519_batch_none_valid(valid, num);
+	free(memory);
+	return ret;
+}
 
-	/* whether the heap has been extended to include the 128 bit scalars */
-	int extended = 0;
+/*
+	m[i] as a single segment, or the 64 byte prehash m[i] when mlen is NULL. ctx
+	is NULL for plain Ed25519, otherwise each signature is under dom2(phflag, ctx[i])
+*/
+static int
+ed25519_sign_open_batch_windows(ed25519_batch_context *batch, unsigned char phflag, const unsigned char **m, size_t *mlen, const unsigned char **ctx, size_t *ctxlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	size_t i, windowsize;
+	int ret = 0;
 
-	/* grab an odd number of scalars to build the heap, unknown limb sizes */
-	heap_build(heap, ((count + 1) / 2) | 1);
+	for (i = 0; i < max_batch_size; i++) {
+		batch->iov[i] = &batch->segment[i];
+		batch->iovcnt[i] = 1;
+	}
 
-	for (;;) {
-		heap_get_top2(heap, &max1, &max2, limbsize);
+	while (num > 0) {
+		windowsize = (num > max_batch_size) ? max_batch_size : num;
+		for (i = 0; i < windowsize; i++) {
+			batch->segment[i].iov_base = m[i];
+			batch->segment[i].iov_len = (mlen) ? mlen[i] : 64;
+			if (ctx)
+				ed25519_dom2_init(&batch->dom[i], phflag, ctx[i], ctxlen[i]);
+		}
+		ret |= ed25519_sign_open_batch_dom2(batch, (ctx) ? batch->dom : NULL, batch->iov, batch->iovcnt, pk, RS, windowsize, valid);
+
+		m += windowsize;
+		if (mlen)
+			mlen += windowsize;
+		if (ctx) {
+			ctx += windowsize;
+			ctxlen += windowsize;
+		}
+		pk += windowsize;
+		RS += windowsize;
+		num -= windowsize;
+		valid += windowsize;
+	}
 
-		/* only one scalar remaining, we're done */
-		if (iszero256_modm_batch(heap->scalars[max2]))
-			break;
+	return ret;
+}
+
+int
+ED25519_FN(ed25519_sign_open_batch_ctx) (ed25519_batch_context *ctx, const unsigned char **m, size_t *mlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	return ed25519_sign_open_batch_windows(ctx, 0, m, mlen, NULL, NULL, pk, RS, num, valid);
+}
+
+int
+ED25519_FN(ed25519_sign_open_batch) (const unsigned char **m, size_t *mlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	void *memory;
+	ed25519_batch_context *batch = ed25519_batch_context_alloc(&memory);
+	int ret = batch ? ed25519_sign_open_batch_windows(batch, 0, m, mlen, NULL, NULL, pk, RS, num, valid) : ed25519_batch_none_valid(valid, num);
+	free(memory);
+	return ret;
+}
 
-		/* exhausted another limb? */
-		if (!heap->scalars[max1][limbsize])
-			limbsize -= 1;
+int
+ED25519_FN(ed25519ph_sign_open_batch) (const unsigned char **prehash, const unsigned char **ctx, size_t *ctxlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	void *memory;
+	ed25519_batch_context *batch = ed25519_batch_context_alloc(&memory);
+	int ret = batch ? ed25519_sign_open_batch_windows(batch, 1, prehash, NULL, ctx, ctxlen, pk, RS, num, valid) : ed25519_batch_none_valid(valid, num);
+	free(memory);
+	return ret;
+}
+
+int
+ED25519_FN(ed25519ctx_sign_open_batch) (const unsigned char **m, size_t *mlen, const unsigned char **ctx, size_t *ctxlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
+	void *memory;
+	ed25519_batch_context *batch = ed25519_batch_context_alloc(&memory);
+	int ret = batch ? ed25519_sign_open_batch_windows(batch, 0, m, mlen, ctx, ctxlen, pk, RS, num, valid) : ed25519_batch_none_valid(valid, num);
+	free(memory);
+	return ret;
+}
 
-		/* can we extend to the 128 bit scalars? */
-		if (!extended && isatmost128bits256_modm_batch(heap->scalars[max1])) {
-			heap_extend(heap, count);
-			heap_get_top2(heap, &max1, &max2, limbsize);
-			extended = 1;
+/* the curve stage for records from ed25519_sign_open_prepare */
+int
+ED25519_FN(ed25519_sign_open_batch_prepared_ctx) (ed25519_batch_context *ctx, const ed25519_prepared_signature *prepared, size_t num, int *valid) {
+	const unsigned char **pk = ctx->prepared_pk, **RS = ctx->prepared_RS;
+	size_t i, windowsize, batchsize;
+	int ret = 0, result;
+
+	while (num > 0) {
+		windowsize = (num > max_batch_size) ? max_batch_size : num;
+
+		for (i = 0, batchsize = 0; i < windowsize; i++) {
+			pk[i] = prepared[i].pk;
+			RS[i] = prepared[i].RS;
+			if (ed25519_signature_s_invalid(RS[i])) {
+				valid[i] = 0;
+				ret |= 1;
+				continue;
+			}
+			ed25519_prepared_hash(ctx->hram[batchsize], &prepared[i]);
+			if (ed25519_verify_cache_find(&result, ctx->hram[batchsize], RS[i])) {
+				valid[i] = result ? 0 : 1;
+				ret |= (valid[i] ^ 1);
+			} else {
+				valid[i] = 1;
+				ctx->sig_index[batchsize++] = i;
+			}
 		}
 
-		sub256_modm_batch(heap->scalars[max1], heap->scalars[max1], heap->scalars[max2], limbsize);
-		ge25519_add(&heap->points[max2], &heap->points[max2], &heap->points[max1]);
-		heap_updated_root(heap, limbsize);
+		ret |= ed25519_batch_verify_hashed(ctx, pk, RS, batchsize, valid);
+
+		prepared += windowsize;
+		num -= windowsize;
+		valid += windowsize;
 	}
 
-	ge25519_multi_scalarmult_vartime_final(r, &heap->points[max1], heap->scalars[max1]);
+	return ret;
 }
 
-/* not actually used for anything other than testing */
-unsigned char batch_point_buffer[3][32];
-
-static int
-ge25519_is_neutral_vartime(const ge25519 *p) {
-	static const unsigned char zero[32] = {0};
-	unsigned char point_buffer[3][32];
-	curve25519_contract(point_buffer[0], p->x);
-	curve25519_contract(point_buffer[1], p->y);
-	curve25519_contract(point_buffer[2], p->z);
-	memcpy(batch_point_buffer[1], point_buffer[1], 32);
-	return (memcmp(point_buffer[0], zero, 32) == 0) && (memcmp(point_buffer[1], point_buffer[2], 32) == 0);
+int
+ED25519_FN(ed25519_sign_open_batch_prepared) (const ed25519_prepared_signature *prepared, size_t num, int *valid) {
+	void *memory;
+	ed25519_batch_context *ctx = ed25519_batch_context_alloc(&memory);
+	int ret = ctx ? ED25519_FN(ed25519_sign_open_batch_prepared_ctx) (ctx, prepared, num, valid) : ed25519_batch_none_valid(valid, num);
+	free(memory);
+	return ret;
 }
 
+/*
+	pk i is at pks + 32i, signature i at sigs + 64i and message i is
+	m[offsets[i]..offsets[i+1]), so num + 1 offsets are read. bit i of valid
+	(least significant bit first) is set when signature i is valid
+*/
 int
-ED25519_FN(ed25519_sign_open_batch) (const unsigned char **m, size_t *mlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid) {
-	batch_heap ALIGN(16) batch;
-	ge25519 ALIGN(16) p;
-	bignum256modm *r_scalars;
-	size_t i, batchsize;
-	unsigned char hram[64];
+ED25519_FN(ed25519_sign_open_batch_packed) (const unsigned char *m, const size_t *offsets, const unsigned char *pks, const unsigned char *sigs, size_t num, unsigned char *valid) {
+	void *memory;
+	ed25519_batch_context *batch = ed25519_batch_context_alloc(&memory);
+	ed25519_iovec *segment;
+	const unsigned char *pk[max_batch_size], *RS[max_batch_size];
+	int window_valid[max_batch_size];
+	size_t i, base, windowsize;
 	int ret = 0;
 
-	for (i = 0; i < num; i++)
-		valid[i] = 1;
-
-	while (num > 3) {
-		batchsize = (num > max_batch_size) ? max_batch_size : num;
+	memset(valid, 0, (num + 7) / 8);
+	if (!batch) {
+		free(memory);
+		return num ? 1 : 0;
+	}
 
-		/* generate r (scalars[batchsize+1]..scalars[2*batchsize] */
-		ED25519_FN(ed25519_randombytes_unsafe) (batch.r, batchsize * 16);
-		r_scalars = &batch.scalars[batchsize + 1];
-		for (i = 0; i < batchsize; i++)
-			expand256_modm(r_scalars[i], batch.r[i], 16);
+	segment = batch->segment;
+	for (i = 0; i < max_batch_size; i++) {
+		batch->iov[i] = &segment[i];
+		batch->iovcnt[i] = 1;
+	}
 
-		/* compute scalars[0] = ((r1s1 + r2s2 + ...)) */
-		for (i = 0; i < batchsize; i++) {
-			expand256_modm(batch.scalars[i], RS[i] + 32, 32);
-			mul256_modm(batch.scalars[i], batch.scalars[i], r_scalars[i]);
+	for (base = 0; base < num; base += windowsize) {
+		windowsize = ((num - base) > max_batch_size) ? max_batch_size : (num - base);
+		for (i = 0; i < windowsize; i++) {
+			segment[i].iov_base = m + offsets[base + i];
+			segment[i].iov_len = offsets[base + i + 1] - offsets[base + i];
+			pk[i] = pks + (base + i) * 32;
+			RS[i] = sigs + (base + i) * 64;
 		}
-		for (i = 1; i < batchsize; i++)
-			add256_modm(batch.scalars[0], batch.scalars[0], batch.scalars[i]);
+		ret |= ed25519_sign_open_batch_dom2(batch, NULL, batch->iov, batch->iovcnt, pk, RS, windowsize, window_valid);
+		for (i = 0; i < windowsize; i++)
+			valid[(base + i) / 8] |= (unsigned char)(window_valid[i] << ((base + i) & 7));
+	}
 
-		/* compute scalars[1]..scalars[batchsize] as r[i]*H(R[i],A[i],m[i]) */
-		for (i = 0; i < batchsize; i++) {
-			ed25519_hram(hram, RS[i], pk[i], m[i], mlen[i]);
-			expand256_modm(batch.scalars[i+1], hram, 64);
-			mul256_modm(batch.scalars[i+1], batch.scalars[i+1], r_scalars[i]);
-		}
+	free(memory);
+	return ret;
+}
 
-		/* compute points */
-		batch.points[0] = ge25519_basepoint;
-		for (i = 0; i < batchsize; i++)
-			if (!ge25519_unpack_negative_vartime(&batch.points[i+1], pk[i]))
-				goto fallback;
-		for (i = 0; i < batchsize; i++)
-			if (!ge25519_unpack_negative_vartime(&batch.points[batchsize+i+1], RS[i]))
-				goto fallback;
+/*
+	Signed record logs, each record is pk[32] || sig[64] || mlen[4] (little endian) || m[mlen].
+	Records are used in place and verified a batch at a time
+*/
 
-		ge25519_multi_scalarmult_vartime(&p, &batch, (batchsize * 2) + 1);
-		if (!ge25519_is_neutral_vartime(&p)) {
-			ret |= 2;
+#define ed25519_log_header_size (32 + 64 + 4)
 
-			fallback:
-			for (i = 0; i < batchsize; i++) {
-				valid[i] = ED25519_FN(ed25519_sign_open) (m[i], mlen[i], pk[i], RS[i]) ? 0 : 1;
-				ret |= (valid[i] ^ 1);
-			}
-		}
+int
+ED25519_FN(ed25519_sign_open_log) (const unsigned char *log, size_t loglen, size_t *verified) {
+	void *memory;
+	ed25519_batch_context *batch = ed25519_batch_context_alloc(&memory);
+	ed25519_iovec *segment;
+	const unsigned char *pk[max_batch_size], *RS[max_batch_size];
+	size_t record[max_batch_size];
+	int valid[max_batch_size];
+	size_t i, count, offset = 0, mlen;
+	int ret = 0;
 
-		m += batchsize;
-		mlen += batchsize;
-		pk += batchsize;
-		RS += batchsize;
-		num -= batchsize;
-		valid += batchsize;
+	*verified = 0;
+	if (!batch) {
+		free(memory);
+		return -1;
 	}
 
-	for (i = 0; i < num; i++) {
-		valid[i] = ED25519_FN(ed25519_sign_open) (m[i], mlen[i], pk[i], RS[i]) ? 0 : 1;
-		ret |= (valid[i] ^ 1);
+	segment = batch->segment;
+	for (i = 0; i < max_batch_size; i++) {
+		batch->iov[i] = &segment[i];
+		batch->iovcnt[i] = 1;
 	}
 
+	for (;;) {
+		/* parse up to a batch of whole records */
+		for (count = 0; count < max_batch_size; count++) {
+			if ((loglen - offset) < ed25519_log_header_size)
+				break;
+			mlen = (size_t)log[offset + 96] | ((size_t)log[offset + 97] << 8) | ((size_t)log[offset + 98] << 16) | ((size_t)log[offset + 99] << 24);
+			if ((loglen - offset - ed25519_log_header_size) < mlen)
+				break;
+			record[count] = offset;
+			pk[count] = log + offset;
+			RS[count] = log + offset + 32;
+			segment[count].iov_base = log + offset + ed25519_log_header_size;
+			segment[count].iov_len = mlen;
+			offset += ed25519_log_header_size + mlen;
+		}
+		if (!count)
+			break;
+
+		ed25519_sign_open_batch_dom2(batch, NULL, batch->iov, batch->iovcnt, pk, RS, count, valid);
+		for (i = 0; i < count; i++) {
+			if (!valid[i]) {
+				*verified = record[i];
+				ret = -1;
+				break;
+			}
+		}
+		if (ret)
+			break;
+		*verified = offset;
+	}
+
+	free(memory);
 	return ret;
 }
 
+/*
+	Incremental batches. Each signature is hashed and its R (and key, unless the
+	batch already has it) decompressed as it is added, so only the multi-scalar
+	multiplication is left for the flush. -R goes to points[max_batch_size+1+i]
+	and is moved down next to the keys at the flush
+*/
+struct ed25519_batch_accumulator_t {
+	batch_heap ALIGN(64) batch;
+	ge25519_msm_scratch ALIGN(64) scratch; /* batch.scratch */
+	unsigned char hram[max_batch_size][64];
+	unsigned char RS[max_batch_size][64];
+	unsigned char key_pk[max_batch_size][32];
+	const unsigned char *sig_RS[max_batch_size];
+	size_t key_index[max_batch_size];
+	void *tag[max_batch_size];
+	size_t count, keys, threshold;
+	ed25519_batch_callback callback;
+	void *arg;
+};
+
+size_t
+ED25519_FN(ed25519_batch_accumulator_size) (void) {
+	return sizeof(ed25519_batch_accumulator) + 63;
+}
+
+ed25519_batch_accumulator *
+ED25519_FN(ed25519_batch_accumulator_init) (void *memory, size_t len, size_t threshold, ed25519_batch_callback callback, void *arg) {
+	ed25519_batch_accumulator *acc = (ed25519_batch_accumulator *)ed25519_batch_align(memory, len, sizeof(ed25519_batch_accumulator));
+	if (!acc)
+		return NULL;
+	acc->batch.scratch = &acc->scratch;
+	acc->count = 0;
+	acc->keys = 0;
+	acc->threshold = (!threshold || (threshold > max_batch_size)) ? max_batch_size : threshold;
+	acc->callback = callback;
+	acc->arg = arg;
+	return acc;
+}
+
+int
+ED25519_FN(ed25519_batch_accumulator_flush) (ed25519_batch_accumulator *acc) {
+	batch_heap *batch = &acc->batch;
+	size_t i, count = acc->count, keys = acc->keys;
+	int ret = 0, valid;
+
+	if (!count)
+		return 0;
+
+	if (count > 3) {
+		memmove(&batch->points[keys + 1], &batch->points[max_batch_size + 1], count * sizeof(ge25519));
+		for (i = 0; i < count; i++)
+			acc->sig_RS[i] = acc->RS[i];
+	}
+	if ((count > 3) && ed25519_batch_check(batch, acc->hram, acc->sig_RS, acc->key_index, keys, count)) {
+		for (i = 0; i < count; i++) {
+			ed25519_batch_cache_valid(acc->hram[i], acc->RS[i]);
+			acc->callback(acc->arg, acc->tag[i], 1);
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			valid = ed25519_sign_open_hram(acc->hram[i], acc->key_pk[acc->key_index[i]], acc->RS[i]) ? 0 : 1;
+			ret |= (valid ^ 1);
+			acc->callback(acc->arg, acc->tag[i], valid);
+		}
+	}
+
+	acc->count = 0;
+	acc->keys = 0;
+	return ret ? -1 : 0;
+}
+
+int
+ED25519_FN(ed25519_batch_accumulator_add) (ed25519_batch_accumulator *acc, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, void *tag) {
+	batch_heap *batch = &acc->batch;
+	size_t i = acc->count, k;
+	int result;
+
+	ed25519_hram(acc->hram[i], RS, pk, m, mlen);
+	if (ed25519_verify_cache_find(&result, acc->hram[i], RS))
+		goto settled;
+
+	/* a signature that can't be batched is settled on its own, which rejects it */
+	if (ed25519_signature_s_invalid(RS) || !ge25519_unpack_negative_vartime(&batch->points[max_batch_size + 1 + i], RS))
+		goto single;
+
+	for (k = 0; k < acc->keys; k++)
+		if (memcmp(acc->key_pk[k], pk, 32) == 0)
+			break;
+	if (k == acc->keys) {
+		if (!ed25519_unpack_key_vartime(&batch->points[k + 1], NULL, pk))
+			goto single;
+		memcpy(acc->key_pk[k], pk, 32);
+		acc->keys++;
+	}
+
+	memcpy(acc->RS[i], RS, 64);
+	acc->key_index[i] = k;
+	acc->tag[i] = tag;
+	if (++acc->count == acc->threshold)
+		return ED25519_FN(ed25519_batch_accumulator_flush) (acc);
+	return 0;
+
+single:
+	result = ed25519_sign_open_hram(acc->hram[i], pk, RS);
+settled:
+	acc->callback(acc->arg, tag, result ? 0 : 1);
+	return result;
+}
@@ -0,0 +1,113 @@
+/*
+	Fixed base scalar multiplication for arbitrary points
+
+	ge25519_niels_table_build computes the same kind of table as
+	ge25519_niels_base_multiples for any point, at runtime, and
+	ge25519_scalarmult_niels_table uses it with the basepoint
+	choose/nielsadd2 machinery.
+
+	A table has 'positions' rows of 8 packed niels points (96 bytes each).
+	With 32 positions the layout is identical to ge25519_niels_base_multiples,
+	fewer positions trade table size for extra doublings:
+
+	positions   table size   doublings
+	       64         48kb           0
+	       32         24kb           4
+	       16         12kb          12
+	        8          6kb          28
+
+	Tables must be 16 byte aligned for the SSE2 choose routines.
+*/
+
+DONNA_INLINE static int
+ge25519_niels_table_positions_valid(size_t positions) {
+	return (positions == 8) || (positions == 16) || (positions == 32) || (positions == 64);
+}
+
+/* table[(pos * 8) + i] = [i+1][16^(pos * (64 / positions))]p */
+static void
+ge25519_niels_table_build(uint8_t table[][96], const ge25519 *p, size_t positions) {
+	ge25519 ALIGN(16) base, multiples[8];
+	bignum25519 ALIGN(16) zi[8], acc, x, y, t;
+	size_t doublings = (64 / positions) * 4, pos, i;
+
+	base = *p;
+	for (pos = 0; pos < positions; pos++) {
+		/* multiples[i] = [i+1]base */
+		multiples[0] = base;
+		ge25519_double(&multiples[1], &base);
+		for (i = 2; i < 8; i++)
+			ge25519_add(&multiples[i], &multiples[i - 1], &base);
+
+		/* invert the 8 z coordinates with a single inversion */
+		curve25519_copy(zi[0], multiples[0].z);
+		for (i = 1; i < 8; i++)
+			curve25519_mul(zi[i], zi[i - 1], multiples[i].z);
+		curve25519_recip(acc, zi[7]);
+		for (i = 7; i > 0; i--) {
+			curve25519_mul(zi[i], acc, zi[i - 1]);
+			curve25519_mul(acc, acc, multiples[i].z);
+		}
+		curve25519_copy(zi[0], acc);
+
+		for (i = 0; i < 8; i++) {
+			uint8_t *packed = table[(pos * 8) + i];
+			curve25519_mul(x, multiples[i].x, zi[i]);
+			curve25519_mul(y, multiples[i].y, zi[i]);
+			curve25519_sub_reduce(t, y, x);
+			curve25519_contract(packed + 0, t);
+			curve25519_add_reduce(t, y, x);
+			curve25519_contract(packed + 32, t);
+			curve25519_mul(t, x, y);
+			/* the first row is used to seed the accumulator, so it holds 2xy instead of 2dxy */
+			if (pos == 0)
+				curve25519_add_reduce(t, t, t);
+			else
+				curve25519_mul(t, t, ge25519_ec2d);
+			curve25519_contract(packed + 64, t);
+		}
+
+		/* base = [16^(64 / positions)]base */
+		if (pos + 1 < positions) {
+			for (i = 0; i < doublings - 1; i++)
+				ge25519_double_partial(&base, &base);
+			ge25519_double(&base, &base);
+		}
+	}
+}
+
+/* computes [s]p, where table was built from p with ge25519_niels_table_build */
+static void
+ge25519_scalarmult_niels_table(ge25519 *r, const uint8_t table[][96], size_t positions, const bignum256modm s) {
+	signed char b[64];
+	size_t teeth = 64 / positions, i, j;
+	ge25519_niels ALIGN(16) t;
+
+	contract256_window4_modm(b, s);
+
+	/* digit i is at row i / teeth, shifted left by 4 * (i % teeth) bits */
+	ge25519_scalarmult_base_choose_niels(&t, table, 0, b[teeth - 1]);
+	curve25519_sub_reduce(r->x, t.xaddy, t.ysubx);
+	curve25519_add_reduce(r->y, t.xaddy, t.ysubx);
+	memset(r->z, 0, sizeof(bignum25519));
+	r->z[0] = 2;
+	curve25519_copy(r->t, t.t2d);
+	for (i = (teeth - 1) + teeth; i < 64; i += teeth) {
+		ge25519_scalarmult_base_choose_niels(&t, table, (uint32_t)(i / teeth), b[i]);
+		ge25519_nielsadd2(r, &t);
+	}
+
+	for (j = teeth - 1; j-- > 0; ) {
+		ge25519_double_partial(r, r);
+		ge25519_double_partial(r, r);
+		ge25519_double_partial(r, r);
+		ge25519_double(r, r);
+		ge25519_scalarmult_base_choose_niels(&t, table, 0, b[j]);
+		curve25519_mul(t.t2d, t.t2d, ge25519_ecd);
+		ge25519_nielsadd2(r, &t);
+		for (i = j + teeth; i < 64; i += teeth) {
+			ge25519_scalarmult_base_choose_niels(&t, table, (uint32_t)(i / teeth), b[i]);
+			ge25519_nielsadd2(r, &t);
+		}
+	}
+}
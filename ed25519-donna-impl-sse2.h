@@ -280,21 +280,27 @@ ge25519_unpack_negative_vartime(ge25519 *r, const unsigned char p[32]) {
 #define S2_SWINDOWSIZE 7
 #define S2_TABLE_SIZE (1<<(S2_SWINDOWSIZE-2))
 
+/* pre1[i] = [2i+1]p1, the odd multiples used for s1 in ge25519_double_scalarmult_vartime */
 static void
-ge25519_double_scalarmult_vartime(ge25519 *r, const ge25519 *p1, const bignum256modm s1, const bignum256modm s2) {
-	signed char slide1[256], slide2[256];
-	ge25519_pniels ALIGN(16) pre1[S1_TABLE_SIZE];
+ge25519_double_scalarmult_table(ge25519_pniels pre1[S1_TABLE_SIZE], const ge25519 *p1) {
 	ge25519 ALIGN(16) d1;
-	ge25519_p1p1 ALIGN(16) t;
 	int32_t i;
 
-	contract256_slidingwindow_modm(slide1, s1, S1_SWINDOWSIZE);
-	contract256_slidingwindow_modm(slide2, s2, S2_SWINDOWSIZE);
-
 	ge25519_double(&d1, p1);
 	ge25519_full_to_pniels(pre1, p1);
 	for (i = 0; i < S1_TABLE_SIZE - 1; i++)
 		ge25519_pnielsadd(&pre1[i+1], &d1, &pre1[i]);
+}
+
+/* computes [s1]p1 + [s2]basepoint, with the table for p1 from ge25519_double_scalarmult_table */
+static void
+ge25519_double_scalarmult_table_vartime(ge25519 *r, const ge25519_pniels pre1[S1_TABLE_SIZE], const bignum256modm s1, const bignum256modm s2) {
+	signed char slide1[256], slide2[256];
+	ge25519_p1p1 ALIGN(16) t;
+	int32_t i;
+
+	contract256_slidingwindow_modm(slide1, s1, S1_SWINDOWSIZE);
+	contract256_slidingwindow_modm(slide2, s2, S2_SWINDOWSIZE);
 
 	/* set neutral */
 	memset(r, 0, sizeof(ge25519));
@@ -322,13 +328,22 @@ ge25519_double_scalarmult_vartime(ge25519 *r, const ge25519 *p1, const bignum256
 	}
 }
 
-#if !defined(HAVE_GE25519_SCALARMULT_BASE_CHOOSE_NIELS)
+/* computes [s1]p1 + [s2]basepoint */
+DONNA_INLINE static void
+ge25519_double_scalarmult_vartime(ge25519 *r, const ge25519 *p1, const bignum256modm s1, const bignum256modm s2) {
+	ge25519_pniels ALIGN(16) pre1[S1_TABLE_SIZE];
+
+	ge25519_double_scalarmult_table(pre1, p1);
+	ge25519_double_scalarmult_table_vartime(r, pre1, s1, s2);
+}
 
 static uint32_t
 ge25519_windowb_equal(uint32_t b, uint32_t c) {
 	return ((b ^ c) - 1) >> 31;
 }
 
+#if !defined(HAVE_GE25519_SCALARMULT_BASE_CHOOSE_NIELS)
+
 static void
 ge25519_scalarmult_base_choose_niels(ge25519_niels *t, const uint8_t table[256][96], uint32_t pos, signed char b) {
 	bignum25519 ALIGN(16) neg;
@@ -388,3 +403,66 @@ ge25519_scalarmult_base_niels(ge25519 *r, const uint8_t table[256][96], const bi
 		ge25519_nielsadd2(r, &t);
 	}
 }
+
+static void
+ge25519_scalarmult_choose_pniels(ge25519_pniels *t, const ge25519_pniels table[8], signed char b) {
+	bignum25519 ALIGN(16) neg;
+	uint32_t sign = (uint32_t)((unsigned char)b >> 7);
+	uint32_t mask = ~(sign - 1);
+	uint32_t u = (b + mask) ^ mask;
+	uint32_t i, flag;
+
+	/* initialize to the neutral element: ysubx = 1, xaddy = 1, z = 1, t2d = 0 */
+	memset(t, 0, sizeof(ge25519_pniels));
+	t->ysubx[0] = 1;
+	t->xaddy[0] = 1;
+	t->z[0] = 1;
+
+	for (i = 0; i < 8; i++) {
+		flag = ge25519_windowb_equal(u, i + 1);
+		curve25519_move_conditional(t->ysubx, table[i].ysubx, flag);
+		curve25519_move_conditional(t->xaddy, table[i].xaddy, flag);
+		curve25519_move_conditional(t->z, table[i].z, flag);
+		curve25519_move_conditional(t->t2d, table[i].t2d, flag);
+	}
+
+	/* adjust for sign */
+	curve25519_swap_conditional(t->ysubx, t->xaddy, sign);
+	curve25519_neg(neg, t->t2d);
+	curve25519_swap_conditional(t->t2d, neg, sign);
+}
+
+/* computes [s]p in constant time, p may be any point */
+static void
+ge25519_scalarmult(ge25519 *r, const ge25519 *p, const bignum256modm s) {
+	signed char b[64];
+	ge25519_pniels ALIGN(16) pre[8], t;
+	ge25519_p1p1 ALIGN(16) tp1p1;
+	int32_t i;
+
+	contract256_window4_modm(b, s);
+
+	/* pre[i] = [i+1]p */
+	ge25519_full_to_pniels(&pre[0], p);
+	for (i = 0; i < 7; i++)
+		ge25519_pnielsadd(&pre[i+1], p, &pre[i]);
+
+	/* set neutral */
+	memset(r, 0, sizeof(ge25519));
+	r->y[0] = 1;
+	r->z[0] = 1;
+
+	ge25519_scalarmult_choose_pniels(&t, pre, b[63]);
+	ge25519_pnielsadd_p1p1(&tp1p1, r, &t, 0);
+	ge25519_p1p1_to_partial(r, &tp1p1);
+	for (i = 62; i >= 0; i--) {
+		ge25519_double_partial(r, r);
+		ge25519_double_partial(r, r);
+		ge25519_double_partial(r, r);
+		ge25519_double(r, r);
+		ge25519_scalarmult_choose_pniels(&t, pre, b[i]);
+		ge25519_pnielsadd_p1p1(&tp1p1, r, &t, 0);
+		ge25519_p1p1_to_partial(r, &tp1p1);
+	}
+	ge25519_p1p1_to_full(r, &tp1p1);
+}
@@ -0,0 +1,230 @@
+/*
+	Public key decompression for verification
+
+	ed25519_unpack_key_vartime returns -A and the sliding window table for A.
+	Define ED25519_KEY_CACHE to keep both for recently used keys in a process
+	wide cache, which skips the curve25519_pow_two252m3 in decompression and
+	the table setup on a hit.
+
+	The cache is split in to ED25519_KEY_CACHE_SHARDS shards, each with its
+	own lock and ED25519_KEY_CACHE_WAYS entries (~1.5kb each) replaced with
+	CLOCK. Keys that fail to decompress are never cached. The shard comes from
+	a hash of the key keyed with a per process random seed, so keys chosen to
+	land in one shard can not be computed ahead of time to evict the rest.
+*/
+
+#if defined(ED25519_KEY_CACHE) || defined(ED25519_VERIFY_CACHE) || defined(ED25519_NONCE_POOL)
+
+#if defined(OS_WINDOWS)
+	#include <windows.h>
+
+	/* a zeroed SRWLOCK is SRWLOCK_INIT */
+	typedef SRWLOCK ed25519_cache_lock_t;
+	#define ed25519_cache_lock(l) AcquireSRWLockExclusive(l)
+	#define ed25519_cache_unlock(l) ReleaseSRWLockExclusive(l)
+#else
+	#include <pthread.h>
+
+	typedef pthread_mutex_t ed25519_cache_lock_t;
+	#define ed25519_cache_lock(l) pthread_mutex_lock(l)
+	#define ed25519_cache_unlock(l) pthread_mutex_unlock(l)
+#endif
+
+#endif
+
+#if defined(ED25519_KEY_CACHE)
+
+#if !defined(ED25519_KEY_CACHE_SHARDS)
+	#define ED25519_KEY_CACHE_SHARDS 16
+#endif
+
+#if !defined(ED25519_KEY_CACHE_WAYS)
+	#define ED25519_KEY_CACHE_WAYS 16
+#endif
+
+typedef struct ed25519_key_cache_entry_t {
+	ge25519_pniels ALIGN(16) pre[S1_TABLE_SIZE];
+	ge25519 ALIGN(16) A;
+	unsigned char pk[32];
+	unsigned char used, referenced;
+} ed25519_key_cache_entry;
+
+typedef struct ed25519_key_cache_shard_t {
+	ed25519_key_cache_entry entries[ED25519_KEY_CACHE_WAYS];
+	ed25519_cache_lock_t lock;
+	size_t hand, hits, misses;
+} ed25519_key_cache_shard;
+
+static ed25519_key_cache_shard ed25519_key_cache[ED25519_KEY_CACHE_SHARDS];
+static uint32_t ed25519_key_cache_seed[9];
+
+static void
+ed25519_key_cache_init(void) {
+#if !defined(OS_WINDOWS)
+	size_t i;
+	for (i = 0; i < ED25519_KEY_CACHE_SHARDS; i++)
+		pthread_mutex_init(&ed25519_key_cache[i].lock, NULL);
+#endif
+#if !defined(ED25519_TEST)
+	/* the test generator is one deterministic stream behind the batch vectors, leave the seed zero there */
+	ED25519_FN(ed25519_randombytes_unsafe) (ed25519_key_cache_seed, sizeof(ed25519_key_cache_seed));
+#endif
+}
+
+#if defined(OS_WINDOWS)
+static INIT_ONCE ed25519_key_cache_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK
+ed25519_key_cache_init_once(PINIT_ONCE once, PVOID arg, PVOID *context) {
+	(void)once; (void)arg; (void)context;
+	ed25519_key_cache_init();
+	return TRUE;
+}
+#else
+static pthread_once_t ed25519_key_cache_once = PTHREAD_ONCE_INIT;
+#endif
+
+static ed25519_key_cache_shard *
+ed25519_key_cache_get_shard(size_t i) {
+#if defined(OS_WINDOWS)
+	InitOnceExecuteOnce(&ed25519_key_cache_once, ed25519_key_cache_init_once, NULL, NULL);
+#else
+	pthread_once(&ed25519_key_cache_once, ed25519_key_cache_init);
+#endif
+	return &ed25519_key_cache[i];
+}
+
+/* NH over the 8 words of pk with seed[0..7], then mixed with seed[8]. the seed is drawn once per process */
+static ed25519_key_cache_shard *
+ed25519_key_cache_shard_for(const unsigned char pk[32]) {
+	uint32_t w[8];
+	uint64_t h = 0;
+	size_t i;
+
+	ed25519_key_cache_get_shard(0);
+	for (i = 0; i < 8; i++)
+		w[i] = ((uint32_t)pk[i * 4]) | ((uint32_t)pk[i * 4 + 1] << 8) | ((uint32_t)pk[i * 4 + 2] << 16) | ((uint32_t)pk[i * 4 + 3] << 24);
+	for (i = 0; i < 8; i += 2)
+		h += (uint64_t)(uint32_t)(w[i] + ed25519_key_cache_seed[i]) * (uint32_t)(w[i + 1] + ed25519_key_cache_seed[i + 1]);
+	h ^= h >> 32;
+	h *= (uint64_t)(ed25519_key_cache_seed[8] | 1);
+	return ed25519_key_cache_get_shard((size_t)(h >> 32) % ED25519_KEY_CACHE_SHARDS);
+}
+
+/* copies out A (and pre, if not NULL) on a hit */
+static int
+ed25519_key_cache_find(ed25519_key_cache_shard *shard, ge25519 *A, ge25519_pniels pre[S1_TABLE_SIZE], const unsigned char pk[32]) {
+	ed25519_key_cache_entry *e;
+	size_t i;
+
+	for (i = 0; i < ED25519_KEY_CACHE_WAYS; i++) {
+		e = &shard->entries[i];
+		if (e->used && (memcmp(e->pk, pk, 32) == 0)) {
+			*A = e->A;
+			if (pre)
+				memcpy(pre, e->pre, sizeof(e->pre));
+			e->referenced = 1;
+			shard->hits++;
+			return 1;
+		}
+	}
+	shard->misses++;
+	return 0;
+}
+
+/* CLOCK: skip (and clear) referenced entries until an unreferenced one turns up */
+static void
+ed25519_key_cache_insert(ed25519_key_cache_shard *shard, const ge25519 *A, const ge25519_pniels pre[S1_TABLE_SIZE], const unsigned char pk[32]) {
+	ed25519_key_cache_entry *e;
+	size_t i;
+
+	/* another thread may have inserted it while we decompressed */
+	for (i = 0; i < ED25519_KEY_CACHE_WAYS; i++)
+		if (shard->entries[i].used && (memcmp(shard->entries[i].pk, pk, 32) == 0))
+			return;
+
+	for (;;) {
+		e = &shard->entries[shard->hand];
+		shard->hand = (shard->hand + 1) % ED25519_KEY_CACHE_WAYS;
+		if (!e->used || !e->referenced)
+			break;
+		e->referenced = 0;
+	}
+
+	e->A = *A;
+	memcpy(e->pre, pre, sizeof(e->pre));
+	memcpy(e->pk, pk, 32);
+	e->used = 1;
+	e->referenced = 0;
+}
+
+/* hits and misses summed over every shard, both wrap around */
+void
+ED25519_FN(ed25519_key_cache_stats) (size_t *hits, size_t *misses) {
+	ed25519_key_cache_shard *shard;
+	size_t i;
+
+	*hits = 0;
+	*misses = 0;
+	for (i = 0; i < ED25519_KEY_CACHE_SHARDS; i++) {
+		shard = ed25519_key_cache_get_shard(i);
+		ed25519_cache_lock(&shard->lock);
+		*hits += shard->hits;
+		*misses += shard->misses;
+		ed25519_cache_unlock(&shard->lock);
+	}
+}
+
+/* drops every cached key and resets the counters */
+void
+ED25519_FN(ed25519_key_cache_clear) (void) {
+	ed25519_key_cache_shard *shard;
+	size_t i, j;
+
+	for (i = 0; i < ED25519_KEY_CACHE_SHARDS; i++) {
+		shard = ed25519_key_cache_get_shard(i);
+		ed25519_cache_lock(&shard->lock);
+		for (j = 0; j < ED25519_KEY_CACHE_WAYS; j++)
+			shard->entries[j].used = 0;
+		shard->hand = 0;
+		shard->hits = 0;
+		shard->misses = 0;
+		ed25519_cache_unlock(&shard->lock);
+	}
+}
+
+#endif /* ED25519_KEY_CACHE */
+
+/* A = -decompress(pk) and, if pre is not NULL, its sliding window table. 0 if pk is not a valid point */
+static int
+ed25519_unpack_key_vartime(ge25519 *A, ge25519_pniels pre[S1_TABLE_SIZE], const unsigned char pk[32]) {
+#if defined(ED25519_KEY_CACHE)
+	ed25519_key_cache_shard *shard = ed25519_key_cache_shard_for(pk);
+	ge25519_pniels ALIGN(16) table[S1_TABLE_SIZE];
+	int found;
+
+	ed25519_cache_lock(&shard->lock);
+	found = ed25519_key_cache_find(shard, A, pre, pk);
+	ed25519_cache_unlock(&shard->lock);
+	if (found)
+		return 1;
+
+	/* decompress outside the lock */
+	if (!ge25519_unpack_negative_vartime(A, pk))
+		return 0;
+	ge25519_double_scalarmult_table(table, A);
+	if (pre)
+		memcpy(pre, table, sizeof(table));
+
+	ed25519_cache_lock(&shard->lock);
+	ed25519_key_cache_insert(shard, A, table, pk);
+	ed25519_cache_unlock(&shard->lock);
+	return 1;
+#else
+	if (!ge25519_unpack_negative_vartime(A, pk))
+		return 0;
+	if (pre)
+		ge25519_double_scalarmult_table(pre, A);
+	return 1;
+#endif
+}
@@ -0,0 +1,624 @@
+/*
+	Multi-scalar multiplication, r = [s_0]p_0 + [s_1]p_1 + .. + [s_n-1]p_n-1
+
+	ge25519_multi_scalarmult_vartime picks Straus, Bos-Coster or Pippenger from
+	the number of points and the width of the largest scalar.
+
+	ge25519_multi_scalarmult is constant time in the scalars: an interleaved
+	signed 4 bit fixed window Straus over the same tables as ge25519_scalarmult.
+*/
+
+#define straus_max_points 16
+#define pippenger_max_window 8
+
+/*
+	the tables for Straus and Pippenger are ~24kb, so they are passed in rather
+	than put on the stack. only one is in use at a time
+*/
+typedef union ge25519_msm_scratch_t {
+	struct {
+		signed char slides[straus_max_points][256];
+		ge25519_pniels ALIGN(16) pre[straus_max_points][S1_TABLE_SIZE];
+	} straus;
+	struct {
+		ge25519 ALIGN(16) buckets[1 << (pippenger_max_window - 1)];
+		unsigned char used[1 << (pippenger_max_window - 1)];
+	} pippenger;
+} ge25519_msm_scratch;
+
+/*
+	Straus, interleaved sliding windows
+*/
+
+static void
+ge25519_multi_scalarmult_straus_vartime(ge25519 *r, const ge25519 *points, const bignum256modm *scalars, size_t count, ge25519_msm_scratch *scratch) {
+	signed char (*slides)[256] = scratch->straus.slides;
+	ge25519_pniels (*pre)[S1_TABLE_SIZE] = scratch->straus.pre;
+	ge25519 ALIGN(16) d, acc;
+	ge25519_p1p1 ALIGN(16) t;
+	size_t i, j, n;
+	int32_t bit, top;
+
+	/* set neutral */
+	memset(r, 0, sizeof(ge25519));
+	r->y[0] = 1;
+	r->z[0] = 1;
+
+	for (; count; points += n, scalars += n, count -= n) {
+		n = (count > straus_max_points) ? straus_max_points : count;
+
+		top = -1;
+		for (i = 0; i < n; i++) {
+			contract256_slidingwindow_modm(slides[i], scalars[i], S1_SWINDOWSIZE);
+			for (bit = 255; bit > top; bit--) {
+				if (slides[i][bit]) {
+					top = bit;
+					break;
+				}
+			}
+
+			ge25519_double(&d, &points[i]);
+			ge25519_full_to_pniels(pre[i], &points[i]);
+			for (j = 0; j < S1_TABLE_SIZE - 1; j++)
+				ge25519_pnielsadd(&pre[i][j+1], &d, &pre[i][j]);
+		}
+
+		/* every scalar in this chunk is zero */
+		if (top < 0)
+			continue;
+
+		memset(&acc, 0, sizeof(ge25519));
+		acc.y[0] = 1;
+		acc.z[0] = 1;
+
+		for (bit = top; bit >= 0; bit--) {
+			ge25519_double_p1p1(&t, &acc);
+			for (i = 0; i < n; i++) {
+				if (slides[i][bit]) {
+					ge25519_p1p1_to_full(&acc, &t);
+					ge25519_pnielsadd_p1p1(&t, &acc, &pre[i][abs(slides[i][bit]) / 2], (unsigned char)slides[i][bit] >> 7);
+				}
+			}
+			ge25519_p1p1_to_partial(&acc, &t);
+		}
+		ge25519_p1p1_to_full(&acc, &t);
+		ge25519_add(r, r, &acc);
+	}
+}
+
+/*
+	Pippenger, signed bucket method
+*/
+
+/*
+	signed radix 2^w digit of s at 'window', in [-2^(w-1), 2^(w-1)]. The carry in
+	from the lower windows is exactly bit (window * w) - 1 of s, so each digit can
+	be computed independently
+*/
+static int
+ge25519_pippenger_digit(const bignum256modm s, size_t window, size_t w) {
+	size_t bit = window * w, limb, shift;
+	bignum256modm_element_t u;
+
+	if (bit == 0) {
+		u = s[0] << 1;
+	} else {
+		bit -= 1;
+		limb = bit / bignum256modm_bits_per_limb;
+		shift = bit % bignum256modm_bits_per_limb;
+		u = s[limb] >> shift;
+		if (((shift + w + 1) > bignum256modm_bits_per_limb) && ((limb + 1) < bignum256modm_limb_size))
+			u |= s[limb + 1] << (bignum256modm_bits_per_limb - shift);
+	}
+	u &= ((bignum256modm_element_t)1 << (w + 1)) - 1;
+	return (int)((u >> 1) + (u & 1)) - (int)((u >> w) << w);
+}
+
+/* window size minimizing (windows * (points + buckets * 2)) */
+static size_t
+ge25519_pippenger_window(size_t count, size_t bits) {
+	size_t w, cost, best = 2, bestcost = (size_t)-1;
+	for (w = 2; w <= pippenger_max_window; w++) {
+		cost = ((bits + w) / w) * (count + ((size_t)1 << w));
+		if (cost < bestcost) {
+			bestcost = cost;
+			best = w;
+		}
+	}
+	return best;
+}
+
+static void
+ge25519_neg(ge25519 *r, const ge25519 *p) {
+	curve25519_neg(r->x, p->x);
+	curve25519_copy(r->y, p->y);
+	curve25519_copy(r->z, p->z);
+	curve25519_neg(r->t, p->t);
+}
+
+/* all scalars must be < 2^bits */
+static void
+ge25519_multi_scalarmult_pippenger_vartime(ge25519 *r, const ge25519 *points, const bignum256modm *scalars, size_t count, size_t bits, ge25519_msm_scratch *scratch) {
+	ge25519 *buckets = scratch->pippenger.buckets;
+	unsigned char *used = scratch->pippenger.used;
+	ge25519 ALIGN(16) running, sum;
+	ge25519_pniels ALIGN(16) pre;
+	ge25519_p1p1 ALIGN(16) t;
+	size_t w = ge25519_pippenger_window(count, bits), nbuckets = (size_t)1 << (w - 1);
+	size_t windows = (bits + w) / w, window, i, b;
+	int digit, haverunning, havesum;
+
+	/* set neutral */
+	memset(r, 0, sizeof(ge25519));
+	r->y[0] = 1;
+	r->z[0] = 1;
+
+	for (window = windows; window-- > 0; ) {
+		if (window != windows - 1) {
+			for (i = 0; i < w - 1; i++)
+				ge25519_double_partial(r, r);
+			ge25519_double(r, r);
+		}
+
+		/* buckets[b] = sum of the points with digit +-(b + 1) */
+		memset(used, 0, nbuckets);
+		for (i = 0; i < count; i++) {
+			digit = ge25519_pippenger_digit(scalars[i], window, w);
+			if (!digit)
+				continue;
+			b = (size_t)abs(digit) - 1;
+			if (!used[b]) {
+				if (digit > 0)
+					buckets[b] = points[i];
+				else
+					ge25519_neg(&buckets[b], &points[i]);
+				used[b] = 1;
+			} else {
+				ge25519_full_to_pniels(&pre, &points[i]);
+				ge25519_pnielsadd_p1p1(&t, &buckets[b], &pre, (unsigned char)(digit < 0));
+				ge25519_p1p1_to_full(&buckets[b], &t);
+			}
+		}
+
+		/* sum = sum of [b + 1]buckets[b] */
+		haverunning = 0;
+		havesum = 0;
+		for (b = nbuckets; b-- > 0; ) {
+			if (used[b]) {
+				if (haverunning)
+					ge25519_add(&running, &running, &buckets[b]);
+				else
+					running = buckets[b];
+				haverunning = 1;
+			}
+			if (haverunning) {
+				if (havesum)
+					ge25519_add(&sum, &sum, &running);
+				else
+					sum = running;
+				havesum = 1;
+			}
+		}
+
+		if (havesum)
+			ge25519_add(r, r, &sum);
+	}
+}
+
+/*
+	Bounded cost, used when Bos-Coster runs over its budget
+*/
+
+/* number of bits in the largest scalar */
+static size_t
+ge25519_multi_scalarmult_bits(const bignum256modm *scalars, size_t count) {
+	bignum256modm_element_t acc[bignum256modm_limb_size] = {0}, top;
+	size_t i, limb, bits;
+
+	for (i = 0; i < count; i++)
+		for (limb = 0; limb < bignum256modm_limb_size; limb++)
+			acc[limb] |= scalars[i][limb];
+
+	for (limb = bignum256modm_limb_size; limb-- > 0; ) {
+		if (acc[limb]) {
+			bits = limb * bignum256modm_bits_per_limb;
+			for (top = acc[limb]; top; top >>= 1)
+				bits++;
+			return bits;
+		}
+	}
+	return 0;
+}
+
+/*
+	measured crossovers: Pippenger beats Straus from ~64 points with full size
+	scalars and from ~40 points with <= 128 bit scalars
+*/
+#define pippenger_min_points_wide 64
+#define pippenger_min_points_narrow 40
+
+/* r = sum of [scalars[i]]points[i], variable time with a cost that only depends on count */
+static void
+ge25519_multi_scalarmult_bounded_vartime(ge25519 *r, const ge25519 *points, const bignum256modm *scalars, size_t count, ge25519_msm_scratch *scratch) {
+	size_t bits = ge25519_multi_scalarmult_bits(scalars, count);
+	size_t pippenger_min = (bits > 128) ? pippenger_min_points_wide : pippenger_min_points_narrow;
+
+	if (count < pippenger_min)
+		ge25519_multi_scalarmult_straus_vartime(r, points, scalars, count, scratch);
+	else
+		ge25519_multi_scalarmult_pippenger_vartime(r, points, scalars, count, bits, scratch);
+}
+
+/*
+	Bos-Coster
+*/
+
+#define max_batch_size 64
+#define heap_batch_size ((max_batch_size * 2) + 1)
+
+/* which limb is the 128th bit in? */
+static const size_t limb128bits = (128 + bignum256modm_bits_per_limb - 1) / bignum256modm_bits_per_limb;
+
+typedef size_t heap_index_t;
+
+/*
+	the heap is 4-ary and only holds (top limb, index) pairs. top is the scalar limb
+	at the current limb size, so most comparisons never touch the scalars. the first
+	heap_arity - 1 entries are padding so the children of a node share a cache line
+*/
+#define heap_arity 4
+
+typedef struct batch_heap_entry_t {
+	bignum256modm_element_t top;
+	heap_index_t index;
+} batch_heap_entry;
+
+typedef struct batch_heap_t {
+	unsigned char r[heap_batch_size][16]; /* 128 bit random values */
+	ge25519 points[heap_batch_size];
+	bignum256modm scalars[heap_batch_size];
+	batch_heap_entry ALIGN(64) heap[heap_batch_size + heap_arity - 1];
+	size_t size;
+	size_t limbsize;
+	ge25519_msm_scratch *scratch; /* tables for the budget fallback, NULL to allocate them if it runs */
+} batch_heap;
+
+#define heap_entries(heap) ((heap)->heap + (heap_arity - 1))
+
+/* is the scalar for a < the scalar for b */
+static DONNA_INLINE int
+heap_entry_lt(const batch_heap *heap, const batch_heap_entry *a, const batch_heap_entry *b) {
+	if (a->top != b->top)
+		return a->top < b->top;
+	return lt256_modm_batch(heap->scalars[a->index], heap->scalars[b->index], heap->limbsize);
+}
+
+/* is the scalar for a <= the scalar for b */
+static DONNA_INLINE int
+heap_entry_lte(const batch_heap *heap, const batch_heap_entry *a, const batch_heap_entry *b) {
+	if (a->top != b->top)
+		return a->top < b->top;
+	return lte256_modm_batch(heap->scalars[a->index], heap->scalars[b->index], heap->limbsize);
+}
+
+/* add the scalar at the end of the list to the heap */
+static void
+heap_insert_next(batch_heap *heap) {
+	batch_heap_entry *pheap = heap_entries(heap), entry;
+	size_t node = heap->size, parent;
+
+	entry.index = (heap_index_t)node;
+	entry.top = heap->scalars[node][heap->limbsize];
+
+	/* sift node up to its sorted spot */
+	while (node) {
+		parent = (node - 1) / heap_arity;
+		if (!heap_entry_lt(heap, &pheap[parent], &entry))
+			break;
+		pheap[node] = pheap[parent];
+		node = parent;
+	}
+	pheap[node] = entry;
+	heap->size++;
+}
+
+/* update the heap when the root element is updated */
+static void
+heap_updated_root(batch_heap *heap) {
+	batch_heap_entry *pheap = heap_entries(heap), root = pheap[0];
+	size_t node = 0, parent, child, last, i;
+
+	root.top = heap->scalars[root.index][heap->limbsize];
+
+	/* move the hole at the root to the bottom along the largest children */
+	while ((child = (node * heap_arity) + 1) < heap->size) {
+		last = child + heap_arity;
+		if (last > heap->size)
+			last = heap->size;
+		for (i = child + 1; i < last; i++) {
+			if (heap_entry_lt(heap, &pheap[child], &pheap[i]))
+				child = i;
+		}
+		pheap[node] = pheap[child];
+		node = child;
+	}
+
+	/* sift root back up to its sorted spot */
+	while (node) {
+		parent = (node - 1) / heap_arity;
+		if (!heap_entry_lte(heap, &pheap[parent], &root))
+			break;
+		pheap[node] = pheap[parent];
+		node = parent;
+	}
+	pheap[node] = root;
+}
+
+/* drop the top limb once every scalar has exhausted it, the order is unchanged */
+static void
+heap_shrink_limbsize(batch_heap *heap) {
+	batch_heap_entry *pheap = heap_entries(heap);
+	size_t i;
+
+	heap->limbsize -= 1;
+	for (i = 0; i < heap->size; i++)
+		pheap[i].top = heap->scalars[pheap[i].index][heap->limbsize];
+}
+
+/* build the heap with count elements, count must be >= 3 */
+static void
+heap_build(batch_heap *heap, size_t count) {
+	heap->size = 0;
+	heap->limbsize = bignum256modm_limb_size - 1;
+	while (heap->size < count)
+		heap_insert_next(heap);
+}
+
+/* extend the heap to contain new_count elements */
+static void
+heap_extend(batch_heap *heap, size_t new_count) {
+	while (heap->size < new_count)
+		heap_insert_next(heap);
+}
+
+/* get the top 2 elements of the heap */
+static void
+heap_get_top2(batch_heap *heap, heap_index_t *max1, heap_index_t *max2) {
+	const batch_heap_entry *pheap = heap_entries(heap), *top = &pheap[1];
+	size_t i, last = (heap->size < (heap_arity + 1)) ? heap->size : (heap_arity + 1);
+
+	for (i = 2; i < last; i++) {
+		if (heap_entry_lt(heap, top, &pheap[i]))
+			top = &pheap[i];
+	}
+	*max1 = pheap[0].index;
+	*max2 = top->index;
+}
+
+static DONNA_INLINE void
+ge25519_prefetch(const ge25519 *p) {
+	const char *c = (const char *)p;
+	DONNA_PREFETCH(c);
+	DONNA_PREFETCH(c + 64);
+	DONNA_PREFETCH(c + 128);
+	DONNA_PREFETCH(c + sizeof(ge25519) - 1);
+}
+
+/* r = [scalar]point for the single scalar left after bos-coster */
+static void
+ge25519_multi_scalarmult_boscoster_final(ge25519 *r, ge25519 *point, bignum256modm scalar) {
+	const bignum256modm_element_t topbit = ((bignum256modm_element_t)1 << (bignum256modm_bits_per_limb - 1));
+	size_t limb = bignum256modm_limb_size - 1;
+	bignum256modm_element_t flag;
+
+	if (isone256_modm_batch(scalar)) {
+		/* this will happen most of the time after bos-carter */
+		*r = *point;
+		return;
+	} else if (iszero256_modm_batch(scalar)) {
+		/* this will only happen if all scalars == 0 */
+		memset(r, 0, sizeof(*r));
+		r->y[0] = 1;
+		r->z[0] = 1;
+		return;
+	}
+
+	*r = *point;
+
+	/* find the limb where first bit is set */
+	while (!scalar[limb])
+		limb--;
+
+	/* find the first bit, r already accounts for it */
+	flag = topbit;
+	while ((scalar[limb] & flag) == 0)
+		flag >>= 1;
+
+	/* exponentiate */
+	for (;;) {
+		flag >>= 1;
+		if (!flag) {
+			if (!limb--)
+				break;
+			flag = topbit;
+		}
+
+		ge25519_double(r, r);
+		if (scalar[limb] & flag)
+			ge25519_add(r, r, point);
+	}
+}
+
+/*
+	random scalars take at most ~1.2 * (count * 256) / log2(count) iterations with
+	very little spread, crafted scalars (e.g. one large and one tiny) can take ~2^252.
+	under 2 scalars log2(count) is 0, and the budget is that of 2
+*/
+static size_t
+ge25519_boscoster_budget(size_t count) {
+	size_t lg = 0;
+	if (count < 2)
+		return 3 * 2 * 128;
+	while (count >> (lg + 1))
+		lg++;
+	return (3 * count * 128) / lg;
+}
+
+/* evaluates the heap with the bounded method, 0 if there were no tables and none could be allocated */
+static int
+ge25519_boscoster_fallback(ge25519 *r, batch_heap *heap, size_t count) {
+	ge25519_msm_scratch *scratch = heap->scratch;
+	void *memory = NULL;
+
+	if (!scratch) {
+		memory = malloc(sizeof(ge25519_msm_scratch) + 63);
+		if (!memory)
+			return 0;
+		scratch = (ge25519_msm_scratch *)((unsigned char *)memory + ((64 - ((uintptr_t)memory & 63)) & 63));
+	}
+	ge25519_multi_scalarmult_bounded_vartime(r, heap->points, (const bignum256modm *)heap->scalars, count, scratch);
+	free(memory);
+	return 1;
+}
+
+/*
+	computes the sum of [heap->scalars[i]]heap->points[i], destroying both, and
+	returns the number of iterations
+
+	the heap starts with the first 'initial' scalars, the rest must fit in 128 bits
+	and are only added once the largest scalar does. initial must be >= 3
+
+	once ge25519_boscoster_budget(count) iterations have run, the remaining sum is
+	handed to ge25519_multi_scalarmult_bounded_vartime, so the cost is bounded no
+	matter how the scalars were chosen. if heap->scratch is NULL its tables are
+	allocated then, and if that fails Bos-Coster carries on past the budget
+*/
+static size_t
+ge25519_multi_scalarmult_boscoster_vartime(ge25519 *r, batch_heap *heap, size_t initial, size_t count) {
+	heap_index_t max1, max2;
+	size_t iterations = 0, budget = ge25519_boscoster_budget(count);
+
+	/* whether the heap has been extended to include the 128 bit scalars */
+	int extended = (initial == count);
+
+	/* starts with the full limb size */
+	heap_build(heap, initial);
+
+	for (;;) {
+		heap_get_top2(heap, &max1, &max2);
+
+		/* can we extend to the 128 bit scalars? they are also needed if the rest ran out */
+		if (!extended && (isatmost128bits256_modm_batch(heap->scalars[max1]) || iszero256_modm_batch(heap->scalars[max2]))) {
+			heap_extend(heap, count);
+			heap_get_top2(heap, &max1, &max2);
+			extended = 1;
+		}
+
+		/* only one scalar remaining, we're done */
+		if (iszero256_modm_batch(heap->scalars[max2]))
+			break;
+
+		/* over budget, the sum is unchanged so evaluate what is left directly */
+		if ((iterations == budget) && ge25519_boscoster_fallback(r, heap, count))
+			return iterations;
+		iterations++;
+
+		/* exhausted another limb? */
+		if (!heap->scalars[max1][heap->limbsize])
+			heap_shrink_limbsize(heap);
+
+		/* the heap update doesn't need the points, so fetch them behind it */
+		ge25519_prefetch(&heap->points[max1]);
+		ge25519_prefetch(&heap->points[max2]);
+		sub256_modm_batch(heap->scalars[max1], heap->scalars[max1], heap->scalars[max2], heap->limbsize);
+		heap_updated_root(heap);
+		ge25519_add(&heap->points[max2], &heap->points[max2], &heap->points[max1]);
+	}
+
+	ge25519_multi_scalarmult_boscoster_final(r, &heap->points[max1], heap->scalars[max1]);
+	return iterations;
+}
+
+/*
+	Selection
+*/
+
+/*
+	measured crossovers: Straus wins below ~48 points with full size scalars and
+	below ~24 points with <= 128 bit scalars, Bos-Coster up to the heap size, and
+	Pippenger beyond that
+*/
+#define boscoster_min_points_wide 48
+#define boscoster_min_points_narrow 24
+
+/* r = sum of [scalars[i]]points[i], variable time. heap is scratch, ~30kb so it is passed in, and heap->scratch must be set */
+static void
+ge25519_multi_scalarmult_vartime(ge25519 *r, const ge25519 *points, const bignum256modm *scalars, size_t count, batch_heap *heap) {
+	size_t bits = ge25519_multi_scalarmult_bits(scalars, count), i;
+	size_t boscoster_min = (bits > 128) ? boscoster_min_points_wide : boscoster_min_points_narrow;
+
+	if (count < boscoster_min) {
+		ge25519_multi_scalarmult_straus_vartime(r, points, scalars, count, heap->scratch);
+	} else if (count <= heap_batch_size) {
+		for (i = 0; i < count; i++) {
+			heap->points[i] = points[i];
+			memcpy(heap->scalars[i], scalars[i], sizeof(bignum256modm));
+		}
+		ge25519_multi_scalarmult_boscoster_vartime(r, heap, count, count);
+	} else {
+		ge25519_multi_scalarmult_pippenger_vartime(r, points, scalars, count, bits, heap->scratch);
+	}
+}
+
+/*
+	Constant time Straus
+*/
+
+#define straus_consttime_max_points 16
+
+/* r = sum of [scalars[i]]points[i], constant time in the scalars */
+static void
+ge25519_multi_scalarmult(ge25519 *r, const ge25519 *points, const bignum256modm *scalars, size_t count) {
+	signed char b[straus_consttime_max_points][64];
+	ge25519_pniels ALIGN(16) pre[straus_consttime_max_points][8], t;
+	ge25519 ALIGN(16) acc;
+	ge25519_p1p1 ALIGN(16) tp1p1;
+	size_t i, j, n;
+	int32_t digit;
+
+	/* set neutral */
+	memset(r, 0, sizeof(ge25519));
+	r->y[0] = 1;
+	r->z[0] = 1;
+
+	for (; count; points += n, scalars += n, count -= n) {
+		n = (count > straus_consttime_max_points) ? straus_consttime_max_points : count;
+
+		/* pre[i][j] = [j+1]points[i] */
+		for (i = 0; i < n; i++) {
+			contract256_window4_modm(b[i], scalars[i]);
+			ge25519_full_to_pniels(&pre[i][0], &points[i]);
+			for (j = 0; j < 7; j++)
+				ge25519_pnielsadd(&pre[i][j+1], &points[i], &pre[i][j]);
+		}
+
+		memset(&acc, 0, sizeof(ge25519));
+		acc.y[0] = 1;
+		acc.z[0] = 1;
+
+		for (digit = 63; digit >= 0; digit--) {
+			if (digit != 63) {
+				ge25519_double_partial(&acc, &acc);
+				ge25519_double_partial(&acc, &acc);
+				ge25519_double_partial(&acc, &acc);
+				ge25519_double(&acc, &acc);
+			}
+			for (i = 0; i < n; i++) {
+				ge25519_scalarmult_choose_pniels(&t, pre[i], b[i][digit]);
+				ge25519_pnielsadd_p1p1(&tp1p1, &acc, &t, 0);
+				ge25519_p1p1_to_full(&acc, &tp1p1);
+			}
+		}
+		ge25519_add(r, r, &acc);
+	}
+}
@@ -0,0 +1,241 @@
+/*
+	Precomputed nonces for low latency signing
+
+	Define ED25519_NONCE_POOL (and link with -lpthread outside of Windows) for
+	a pool of (r, R = rB) pairs bound to one key, filled ahead of time with
+	ed25519_nonce_pool_fill. A pooled signature then costs H(R,A,m) and
+	S = r + H(R,A,m)a, and skips the base point multiplication.
+
+	R must be known before m, so pooled nonces are hedged on the key instead
+	of the message:
+
+		r = H(aExt[32..64], seed, counter, 32 fresh random bytes)
+
+	seed is drawn when the pool is created and counter counts every nonce the
+	pool has derived, so nonces within a pool never repeat even if the random
+	bytes do. Signatures are valid Ed25519 but not the deterministic ones of
+	ed25519_sign, and a pool must not outlive a broken randombytes across
+	restarts under one key. Each entry is taken and wiped under the pool lock,
+	so it signs exactly one message. An empty pool derives r online with m
+	appended to the hash.
+
+	A forked child inherits the entries, seed and counter of its parent, and
+	would sign with the same r. The pool remembers the pid that created it, and
+	a fill or signature from any other process first wipes the entries and
+	reseeds with H(seed, pid, random) so the two processes diverge. Windows has
+	no fork, so the check is skipped there.
+*/
+
+#if defined(ED25519_NONCE_POOL)
+
+#if !defined(OS_WINDOWS)
+	#include <sys/types.h>
+	#include <unistd.h>
+#endif
+
+typedef struct ed25519_nonce_t {
+	bignum256modm r;
+	unsigned char R[32];
+} ed25519_nonce;
+
+struct ed25519_nonce_pool_t {
+	ed25519_cache_lock_t lock;
+	hash_512bits extsk;
+	unsigned char pk[32], seed[32];
+	uint64_t counter;
+	size_t head, count, pending, capacity;
+#if !defined(OS_WINDOWS)
+	pid_t pid;
+#endif
+	ed25519_nonce entries[1];
+};
+
+/* called under the lock, drops everything inherited across a fork before a nonce is reserved */
+static void
+ed25519_nonce_pool_check_fork(ed25519_nonce_pool *pool) {
+#if !defined(OS_WINDOWS)
+	ed25519_hash_context ctx;
+	hash_512bits seed;
+	unsigned char random[32], id[8];
+	pid_t pid = getpid();
+	size_t i;
+
+	if (pid == pool->pid)
+		return;
+
+	/* fills running in the parent never finish here, so their slots are dropped too */
+	memset(pool->entries, 0, (pool->capacity ? pool->capacity : 1) * sizeof(ed25519_nonce));
+	pool->head = 0;
+	pool->count = 0;
+	pool->pending = 0;
+
+	/* seed = H(seed, pid, random), distinct from the parent even if randombytes repeats */
+	ED25519_FN(ed25519_randombytes_unsafe) (random, 32);
+	for (i = 0; i < 8; i++)
+		id[i] = (unsigned char)((uint64_t)pid >> (i * 8));
+	ed25519_hash_init(&ctx);
+	ed25519_hash_update(&ctx, pool->seed, 32);
+	ed25519_hash_update(&ctx, id, 8);
+	ed25519_hash_update(&ctx, random, 32);
+	ed25519_hash_final(&ctx, seed);
+	memcpy(pool->seed, seed, 32);
+	pool->pid = pid;
+
+	memset(seed, 0, sizeof(seed));
+	memset(random, 0, sizeof(random));
+	memset(&ctx, 0, sizeof(ctx));
+#else
+	(void)pool;
+#endif
+}
+
+/* starts r = H(aExt[32..64], seed, counter, random) for the counter reserved under the lock */
+static void
+ed25519_nonce_pool_hash_init(ed25519_hash_context *ctx, const ed25519_nonce_pool *pool, uint64_t counter) {
+	unsigned char random[32], ctr[8];
+	size_t i;
+
+	ED25519_FN(ed25519_randombytes_unsafe) (random, 32);
+	for (i = 0; i < 8; i++)
+		ctr[i] = (unsigned char)(counter >> (i * 8));
+	ed25519_hash_init(ctx);
+	ed25519_hash_update(ctx, pool->extsk + 32, 32);
+	ed25519_hash_update(ctx, pool->seed, 32);
+	ed25519_hash_update(ctx, ctr, 8);
+	ed25519_hash_update(ctx, random, 32);
+	memset(random, 0, sizeof(random));
+}
+
+ed25519_nonce_pool *
+ED25519_FN(ed25519_nonce_pool_create) (const ed25519_secret_key sk, const ed25519_public_key pk, size_t capacity) {
+	ed25519_nonce_pool *pool;
+
+	pool = (ed25519_nonce_pool *)malloc(sizeof(ed25519_nonce_pool) + ((capacity ? capacity : 1) - 1) * sizeof(ed25519_nonce));
+	if (!pool)
+		return NULL;
+	memset(pool, 0, sizeof(ed25519_nonce_pool));
+#if !defined(OS_WINDOWS)
+	pthread_mutex_init(&pool->lock, NULL);
+#endif
+	ed25519_extsk(pool->extsk, sk);
+	memcpy(pool->pk, pk, 32);
+	ED25519_FN(ed25519_randombytes_unsafe) (pool->seed, 32);
+	pool->capacity = capacity;
+#if !defined(OS_WINDOWS)
+	pool->pid = getpid();
+#endif
+	return pool;
+}
+
+void
+ED25519_FN(ed25519_nonce_pool_destroy) (ed25519_nonce_pool *pool) {
+#if !defined(OS_WINDOWS)
+	pthread_mutex_destroy(&pool->lock);
+#endif
+	memset(pool, 0, sizeof(ed25519_nonce_pool) + ((pool->capacity ? pool->capacity : 1) - 1) * sizeof(ed25519_nonce));
+	free(pool);
+}
+
+size_t
+ED25519_FN(ed25519_nonce_pool_fill) (ed25519_nonce_pool *pool, size_t count) {
+	ed25519_hash_context ctx;
+	ed25519_nonce nonce;
+	ge25519 ALIGN(16) R;
+	hash_512bits hashr;
+	uint64_t counter;
+	size_t added;
+
+	for (added = 0; added < count; added++) {
+		/* reserve a slot and a counter value, then derive outside the lock */
+		ed25519_cache_lock(&pool->lock);
+		ed25519_nonce_pool_check_fork(pool);
+		if ((pool->count + pool->pending) >= pool->capacity) {
+			ed25519_cache_unlock(&pool->lock);
+			break;
+		}
+		pool->pending++;
+		counter = pool->counter++;
+		ed25519_cache_unlock(&pool->lock);
+
+		ed25519_nonce_pool_hash_init(&ctx, pool, counter);
+		ed25519_hash_final(&ctx, hashr);
+		expand256_modm(nonce.r, hashr, 64);
+		ge25519_scalarmult_base_niels(&R, ge25519_niels_base_multiples, nonce.r);
+		ge25519_pack(nonce.R, &R);
+
+		ed25519_cache_lock(&pool->lock);
+		pool->entries[(pool->head + pool->count) % pool->capacity] = nonce;
+		pool->count++;
+		pool->pending--;
+		ed25519_cache_unlock(&pool->lock);
+	}
+
+	memset(&nonce, 0, sizeof(nonce));
+	memset(hashr, 0, sizeof(hashr));
+	return added;
+}
+
+size_t
+ED25519_FN(ed25519_nonce_pool_available) (ed25519_nonce_pool *pool) {
+	size_t count;
+
+	ed25519_cache_lock(&pool->lock);
+	count = pool->count;
+	ed25519_cache_unlock(&pool->lock);
+	return count;
+}
+
+void
+ED25519_FN(ed25519_sign_pooled) (ed25519_nonce_pool *pool, const unsigned char *m, size_t mlen, ed25519_signature RS) {
+	ed25519_hash_context ctx;
+	ed25519_nonce nonce, *entry;
+	bignum256modm S, a;
+	ge25519 ALIGN(16) R;
+	hash_512bits hashr, hram;
+	uint64_t counter = 0;
+	int pooled = 0;
+
+	/* take and wipe the oldest entry, or reserve a counter value for an online nonce */
+	ed25519_cache_lock(&pool->lock);
+	ed25519_nonce_pool_check_fork(pool);
+	if (pool->count) {
+		entry = &pool->entries[pool->head];
+		nonce = *entry;
+		memset(entry, 0, sizeof(ed25519_nonce));
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->count--;
+		pooled = 1;
+	} else {
+		counter = pool->counter++;
+	}
+	ed25519_cache_unlock(&pool->lock);
+
+	if (!pooled) {
+		/* r = H(aExt[32..64], seed, counter, random, m) */
+		ed25519_nonce_pool_hash_init(&ctx, pool, counter);
+		ed25519_hash_update(&ctx, m, mlen);
+		ed25519_hash_final(&ctx, hashr);
+		expand256_modm(nonce.r, hashr, 64);
+		ge25519_scalarmult_base_niels(&R, ge25519_niels_base_multiples, nonce.r);
+		ge25519_pack(nonce.R, &R);
+		memset(hashr, 0, sizeof(hashr));
+		memset(&R, 0, sizeof(R));
+	}
+	memcpy(RS, nonce.R, 32);
+
+	/* S = (r + H(R,A,m)a) mod L */
+	ed25519_hram(hram, RS, pool->pk, m, mlen);
+	expand256_modm(S, hram, 64);
+	expand256_modm(a, pool->extsk, 32);
+	mul256_modm(S, S, a);
+	add256_modm(S, S, nonce.r);
+	contract256_modm(RS + 32, S);
+
+	memset(&nonce, 0, sizeof(nonce));
+	memset(S, 0, sizeof(S));
+	memset(a, 0, sizeof(a));
+	memset(hram, 0, sizeof(hram));
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+#endif /* ED25519_NONCE_POOL */
@@ -25,6 +25,15 @@
 	#define ROTR32(a,b) (((a) >> (b)) | ((a) << (32 - b)))
 #endif
 
+/* prefetch */
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+	#define DONNA_PREFETCH(p) __builtin_prefetch(p)
+#elif defined(COMPILER_MSVC) && (defined(CPU_X86) || defined(CPU_X86_64))
+	#define DONNA_PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+	#define DONNA_PREFETCH(p)
+#endif
+
 /* uint128_t */
 #if defined(CPU_64BITS) && !defined(ED25519_FORCE_32BIT)
 	#if defined(COMPILER_CLANG) && (COMPILER_CLANG >= 30100)
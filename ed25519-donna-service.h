@@ -0,0 +1,531 @@
+/*
+	Verification and signing services
+
+	Define ED25519_VERIFY_SERVICE and/or ED25519_SIGN_SERVICE (and link with
+	-lpthread) for a pool of worker threads that handle requests submitted one at
+	a time from any number of threads in batches: a verify service runs
+	ed25519_sign_open_batch over up to max_batch_size signatures, a sign service
+	runs ed25519_sign_batch over up to sign_batch_size messages, under any mix of
+	keys. Submissions go through bounded lock-free rings (Vyukov's MPMC queue,
+	one cache line per slot), and a worker that finds fewer than a full batch
+	waits up to max_latency microseconds for more before running what it has, so
+	a lone request is delayed by at most that much.
+
+	Each service has an interactive and a bulk queue. Workers take interactive
+	requests first, up to interactive_batch_size at a time and without waiting
+	for more, and look for them again between the preempt_batch_size pieces a
+	bulk batch is run in, so an interactive request waits for at most one piece
+	of bulk work on each worker. Ordinary submissions are bulk.
+
+	Producers only touch the mutex to wake a sleeping worker. Needs pthreads and
+	the gcc/clang __atomic builtins.
+*/
+
+#if defined(ED25519_VERIFY_SERVICE) || defined(ED25519_SIGN_SERVICE)
+
+#if defined(OS_WINDOWS) || !(defined(COMPILER_GCC) || defined(COMPILER_CLANG))
+	#error ED25519_VERIFY_SERVICE and ED25519_SIGN_SERVICE need pthreads and gcc or clang
+#endif
+
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#define interactive_batch_size 8
+#define preempt_batch_size 32
+#define service_histogram_size 24
+
+/* RS is the signature to verify, or where a sign request writes its signature. queued is in microseconds */
+typedef struct ed25519_service_request_t {
+	const unsigned char *m, *pk, *sk;
+	unsigned char *RS;
+	size_t mlen;
+	ed25519_batch_callback callback;
+	void *arg, *tag;
+	unsigned long long queued;
+} ed25519_service_request;
+
+/* sequence == position: free for the producer at position, position + 1: full for the consumer at position */
+typedef struct ed25519_service_slot_t {
+	size_t sequence;
+	ed25519_service_request request;
+} ALIGN(64) ed25519_service_slot;
+
+/* one priority class, the counters are only written by workers */
+typedef struct ed25519_service_queue_t {
+	size_t ALIGN(64) enqueue;
+	size_t ALIGN(64) dequeue;
+	ed25519_service_slot *slots;
+	size_t mask, batch;
+	long max_latency;
+	unsigned long long ALIGN(64) completed;
+	unsigned long long waited, max_wait, histogram[service_histogram_size];
+} ed25519_service_queue;
+
+/* fails to compile if ed25519_service_stats has a different number of buckets */
+typedef char ed25519_service_histogram_mismatch[(sizeof(((ed25519_service_stats *)0)->wait_us_log2) == (service_histogram_size * sizeof(unsigned long long))) ? 1 : -1];
+
+typedef struct ed25519_service_t {
+	ed25519_service_queue queues[2];
+	size_t ALIGN(64) sleepers;
+	int stopping, sign;
+	size_t started;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t *threads;
+} ed25519_service;
+
+static unsigned long long
+ed25519_service_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((unsigned long long)now.tv_sec * 1000000) + ((unsigned long long)now.tv_nsec / 1000);
+}
+
+static int
+ed25519_service_push(ed25519_service_queue *q, const ed25519_service_request *request) {
+	size_t pos = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED), seq;
+	ed25519_service_slot *slot;
+
+	for (;;) {
+		slot = &q->slots[pos & q->mask];
+		seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&q->enqueue, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((ptrdiff_t)(seq - pos) < 0) {
+			/* full */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->request = *request;
+	__atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int
+ed25519_service_pop(ed25519_service_queue *q, ed25519_service_request *request) {
+	size_t pos = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED), seq;
+	ed25519_service_slot *slot;
+
+	for (;;) {
+		slot = &q->slots[pos & q->mask];
+		seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (seq == (pos + 1)) {
+			if (__atomic_compare_exchange_n(&q->dequeue, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((ptrdiff_t)(seq - (pos + 1)) < 0) {
+			/* empty */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED);
+		}
+	}
+
+	*request = slot->request;
+	__atomic_store_n(&slot->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int
+ed25519_service_empty(ed25519_service_queue *q) {
+	size_t pos = __atomic_load_n(&q->dequeue, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&q->slots[pos & q->mask].sequence, __ATOMIC_ACQUIRE) != (pos + 1);
+}
+
+/*
+	sleeps until a request arrives, the service stops or deadline passes (NULL to wait
+	without one). the sleeper count is raised before the queues are checked, and producers
+	check it after pushing, so either the worker sees the request or the producer sees
+	the worker and signals it under the lock
+*/
+static void
+ed25519_service_sleep(ed25519_service *svc, const struct timespec *deadline) {
+	pthread_mutex_lock(&svc->lock);
+	__atomic_add_fetch(&svc->sleepers, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (ed25519_service_empty(&svc->queues[0]) && ed25519_service_empty(&svc->queues[1]) && !__atomic_load_n(&svc->stopping, __ATOMIC_ACQUIRE)) {
+		if (deadline)
+			pthread_cond_timedwait(&svc->wake, &svc->lock, deadline);
+		else
+			pthread_cond_wait(&svc->wake, &svc->lock);
+	}
+	__atomic_sub_fetch(&svc->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&svc->lock);
+}
+
+static int
+ed25519_service_expired(const struct timespec *deadline) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (now.tv_sec > deadline->tv_sec) || ((now.tv_sec == deadline->tv_sec) && (now.tv_nsec >= deadline->tv_nsec));
+}
+
+/* records how long the requests waited, then signs or verifies them and runs the callbacks */
+static void
+ed25519_service_run(ed25519_service *svc, ed25519_service_queue *q, ed25519_batch_context *ctx, ed25519_service_request *requests, size_t count) {
+	const unsigned char *m[max_batch_size], *pk[max_batch_size], *sk[max_batch_size];
+	unsigned char *RS[max_batch_size];
+	size_t mlen[max_batch_size];
+	int valid[max_batch_size];
+	unsigned long long now = ed25519_service_now(), wait, waited = 0, max_wait;
+	size_t i, bucket;
+
+	for (i = 0; i < count; i++) {
+		m[i] = requests[i].m;
+		mlen[i] = requests[i].mlen;
+		pk[i] = requests[i].pk;
+		sk[i] = requests[i].sk;
+		RS[i] = requests[i].RS;
+		valid[i] = 1;
+
+		wait = (now > requests[i].queued) ? (now - requests[i].queued) : 0;
+		waited += wait;
+		for (bucket = 0; (bucket < (service_histogram_size - 1)) && (wait >> bucket); bucket++)
+			;
+		__atomic_add_fetch(&q->histogram[bucket], 1, __ATOMIC_RELAXED);
+		max_wait = __atomic_load_n(&q->max_wait, __ATOMIC_RELAXED);
+		while ((wait > max_wait) && !__atomic_compare_exchange_n(&q->max_wait, &max_wait, wait, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+	__atomic_add_fetch(&q->waited, waited, __ATOMIC_RELAXED);
+
+	if (svc->sign)
+		ED25519_FN(ed25519_sign_batch) (m, mlen, sk, pk, RS, count);
+	else if (ctx)
+		ED25519_FN(ed25519_sign_open_batch_ctx) (ctx, m, mlen, pk, (const unsigned char **)RS, count, valid);
+	else
+		ED25519_FN(ed25519_sign_open_batch) (m, mlen, pk, (const unsigned char **)RS, count, valid);
+	__atomic_add_fetch(&q->completed, count, __ATOMIC_RELAXED);
+	for (i = 0; i < count; i++)
+		requests[i].callback(requests[i].arg, requests[i].tag, valid[i]);
+}
+
+/* runs every interactive request, a few at a time, returns 0 if there were none */
+static int
+ed25519_service_run_interactive(ed25519_service *svc, ed25519_batch_context *ctx) {
+	ed25519_service_queue *q = &svc->queues[0];
+	ed25519_service_request requests[interactive_batch_size];
+	size_t count;
+	int ran = 0;
+
+	for (;;) {
+		for (count = 0; (count < q->batch) && ed25519_service_pop(q, &requests[count]); count++)
+			;
+		if (!count)
+			return ran;
+		ed25519_service_run(svc, q, ctx, requests, count);
+		ran = 1;
+	}
+}
+
+static void *
+ed25519_service_worker(void *arg) {
+	ed25519_service *svc = (ed25519_service *)arg;
+	ed25519_service_queue *bulk = &svc->queues[1];
+	ed25519_service_request requests[max_batch_size];
+	size_t i, n, count, size = ED25519_FN(ed25519_batch_context_size) ();
+	void *memory = svc->sign ? NULL : malloc(size);
+	ed25519_batch_context *ctx = ED25519_FN(ed25519_batch_context_init) (memory, size);
+	struct timespec deadline;
+
+	for (;;) {
+		ed25519_service_run_interactive(svc, ctx);
+
+		for (count = 0; (count < bulk->batch) && ed25519_service_pop(bulk, &requests[count]); count++)
+			;
+
+		if (!count) {
+			if (!ed25519_service_empty(&svc->queues[0]))
+				continue;
+			if (__atomic_load_n(&svc->stopping, __ATOMIC_ACQUIRE))
+				break;
+			ed25519_service_sleep(svc, NULL);
+			continue;
+		}
+
+		/* give a partial batch until the deadline to fill up, serving interactive requests meanwhile */
+		if ((count < bulk->batch) && bulk->max_latency) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += bulk->max_latency * 1000;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000;
+			deadline.tv_nsec %= 1000000000;
+			while ((count < bulk->batch) && !__atomic_load_n(&svc->stopping, __ATOMIC_ACQUIRE)) {
+				if (ed25519_service_pop(bulk, &requests[count])) {
+					count++;
+					continue;
+				}
+				if (ed25519_service_run_interactive(svc, ctx))
+					continue;
+				if (ed25519_service_expired(&deadline))
+					break;
+				ed25519_service_sleep(svc, &deadline);
+			}
+		}
+
+		/* interactive requests get in between the pieces */
+		for (i = 0; i < count; i += n) {
+			n = ((count - i) > preempt_batch_size) ? preempt_batch_size : (count - i);
+			if (i)
+				ed25519_service_run_interactive(svc, ctx);
+			ed25519_service_run(svc, bulk, ctx, requests + i, n);
+		}
+	}
+
+	free(memory);
+	return NULL;
+}
+
+static void
+ed25519_service_stop(ed25519_service *svc) {
+	size_t i;
+
+	pthread_mutex_lock(&svc->lock);
+	__atomic_store_n(&svc->stopping, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&svc->wake);
+	pthread_mutex_unlock(&svc->lock);
+	for (i = 0; i < svc->started; i++)
+		pthread_join(svc->threads[i], NULL);
+
+	pthread_cond_destroy(&svc->wake);
+	pthread_mutex_destroy(&svc->lock);
+	free(svc->threads);
+	free(svc->queues[0].slots);
+	free(svc->queues[1].slots);
+	free(svc);
+}
+
+static ed25519_service *
+ed25519_service_create(size_t threads, size_t capacity, unsigned long max_latency_us, int sign) {
+	ed25519_service *svc;
+	ed25519_service_queue *q;
+	void *memory;
+	size_t i, j, slots = 2;
+
+	if (!threads || !capacity || (capacity > ((size_t)-1 / 4)))
+		return NULL;
+	while (slots < capacity)
+		slots *= 2;
+
+	if (posix_memalign(&memory, 64, sizeof(ed25519_service)) != 0)
+		return NULL;
+	svc = (ed25519_service *)memory;
+	memset(svc, 0, sizeof(ed25519_service));
+	for (j = 0; j < 2; j++) {
+		q = &svc->queues[j];
+		if (posix_memalign(&memory, 64, slots * sizeof(ed25519_service_slot)) != 0) {
+			free(svc->queues[0].slots);
+			free(svc);
+			return NULL;
+		}
+		q->slots = (ed25519_service_slot *)memory;
+		for (i = 0; i < slots; i++)
+			q->slots[i].sequence = i;
+		q->mask = slots - 1;
+	}
+	svc->queues[0].batch = interactive_batch_size;
+	svc->queues[1].batch = sign ? sign_batch_size : max_batch_size;
+	svc->queues[1].max_latency = (long)((max_latency_us > 1000000) ? 1000000 : max_latency_us);
+	svc->sign = sign;
+	pthread_mutex_init(&svc->lock, NULL);
+	pthread_cond_init(&svc->wake, NULL);
+
+	svc->threads = (pthread_t *)malloc(threads * sizeof(pthread_t));
+	if (!svc->threads) {
+		ed25519_service_stop(svc);
+		return NULL;
+	}
+	for (svc->started = 0; svc->started < threads; svc->started++) {
+		if (pthread_create(&svc->threads[svc->started], NULL, ed25519_service_worker, svc) != 0) {
+			ed25519_service_stop(svc);
+			return NULL;
+		}
+	}
+	return svc;
+}
+
+static int
+ed25519_service_submit(ed25519_service *svc, int priority, ed25519_service_request *request) {
+	request->queued = ed25519_service_now();
+	if (!ed25519_service_push(&svc->queues[(priority == ED25519_PRIORITY_INTERACTIVE) ? 0 : 1], request))
+		return -1;
+
+	/* pairs with the fence in ed25519_service_sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&svc->sleepers, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&svc->lock);
+		pthread_cond_signal(&svc->wake);
+		pthread_mutex_unlock(&svc->lock);
+	}
+	return 0;
+}
+
+static void
+ed25519_service_read_stats(ed25519_service *svc, int priority, ed25519_service_stats *stats) {
+	ed25519_service_queue *q = &svc->queues[(priority == ED25519_PRIORITY_INTERACTIVE) ? 0 : 1];
+	size_t enqueue = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED), dequeue = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED), i;
+
+	stats->depth = ((ptrdiff_t)(enqueue - dequeue) > 0) ? (enqueue - dequeue) : 0;
+	stats->completed = __atomic_load_n(&q->completed, __ATOMIC_RELAXED);
+	stats->wait_us_total = __atomic_load_n(&q->waited, __ATOMIC_RELAXED);
+	stats->wait_us_max = __atomic_load_n(&q->max_wait, __ATOMIC_RELAXED);
+	for (i = 0; i < service_histogram_size; i++)
+		stats->wait_us_log2[i] = __atomic_load_n(&q->histogram[i], __ATOMIC_RELAXED);
+}
+
+typedef struct ed25519_service_waiter_t {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int finished, valid;
+} ed25519_service_waiter;
+
+static void
+ed25519_service_waiter_init(ed25519_service_waiter *waiter) {
+	waiter->finished = 0;
+	waiter->valid = 0;
+	pthread_mutex_init(&waiter->lock, NULL);
+	pthread_cond_init(&waiter->done, NULL);
+}
+
+static void
+ed25519_service_wake(void *arg, void *tag, int valid) {
+	ed25519_service_waiter *waiter = (ed25519_service_waiter *)arg;
+	(void)tag;
+	pthread_mutex_lock(&waiter->lock);
+	waiter->valid = valid;
+	waiter->finished = 1;
+	pthread_cond_signal(&waiter->done);
+	pthread_mutex_unlock(&waiter->lock);
+}
+
+static void
+ed25519_service_waiter_wait(ed25519_service_waiter *waiter) {
+	pthread_mutex_lock(&waiter->lock);
+	while (!waiter->finished)
+		pthread_cond_wait(&waiter->done, &waiter->lock);
+	pthread_mutex_unlock(&waiter->lock);
+	pthread_cond_destroy(&waiter->done);
+	pthread_mutex_destroy(&waiter->lock);
+}
+
+#if defined(ED25519_VERIFY_SERVICE)
+
+ed25519_verify_service *
+ED25519_FN(ed25519_verify_service_create) (size_t threads, size_t capacity, unsigned long max_latency_us) {
+	return (ed25519_verify_service *)ed25519_service_create(threads, capacity, max_latency_us, 0);
+}
+
+/* requests already submitted are verified and their callbacks run before this returns */
+void
+ED25519_FN(ed25519_verify_service_destroy) (ed25519_verify_service *svc) {
+	ed25519_service_stop((ed25519_service *)svc);
+}
+
+int
+ED25519_FN(ed25519_verify_service_submit_priority) (ed25519_verify_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag) {
+	ed25519_service_request request;
+
+	request.m = m;
+	request.mlen = mlen;
+	request.pk = pk;
+	request.sk = NULL;
+	request.RS = (unsigned char *)RS;
+	request.callback = callback;
+	request.arg = arg;
+	request.tag = tag;
+	return ed25519_service_submit((ed25519_service *)svc, priority, &request);
+}
+
+int
+ED25519_FN(ed25519_verify_service_submit) (ed25519_verify_service *svc, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag) {
+	return ED25519_FN(ed25519_verify_service_submit_priority) (svc, ED25519_PRIORITY_BULK, m, mlen, pk, RS, callback, arg, tag);
+}
+
+/* blocks until the signature is verified, verifies it directly if the queue is full */
+int
+ED25519_FN(ed25519_verify_service_sign_open_priority) (ed25519_verify_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS) {
+	ed25519_service_waiter waiter;
+
+	ed25519_service_waiter_init(&waiter);
+	if (ED25519_FN(ed25519_verify_service_submit_priority) (svc, priority, m, mlen, pk, RS, ed25519_service_wake, &waiter, NULL) != 0) {
+		waiter.valid = (ED25519_FN(ed25519_sign_open) (m, mlen, pk, RS) == 0);
+		waiter.finished = 1;
+	}
+	ed25519_service_waiter_wait(&waiter);
+	return waiter.valid ? 0 : -1;
+}
+
+int
+ED25519_FN(ed25519_verify_service_sign_open) (ed25519_verify_service *svc, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS) {
+	return ED25519_FN(ed25519_verify_service_sign_open_priority) (svc, ED25519_PRIORITY_BULK, m, mlen, pk, RS);
+}
+
+void
+ED25519_FN(ed25519_verify_service_stats) (ed25519_verify_service *svc, int priority, ed25519_service_stats *stats) {
+	ed25519_service_read_stats((ed25519_service *)svc, priority, stats);
+}
+
+#endif /* ED25519_VERIFY_SERVICE */
+
+#if defined(ED25519_SIGN_SERVICE)
+
+ed25519_sign_service *
+ED25519_FN(ed25519_sign_service_create) (size_t threads, size_t capacity, unsigned long max_latency_us) {
+	return (ed25519_sign_service *)ed25519_service_create(threads, capacity, max_latency_us, 1);
+}
+
+/* requests already submitted are signed and their callbacks run before this returns */
+void
+ED25519_FN(ed25519_sign_service_destroy) (ed25519_sign_service *svc) {
+	ed25519_service_stop((ed25519_service *)svc);
+}
+
+int
+ED25519_FN(ed25519_sign_service_submit_priority) (ed25519_sign_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag) {
+	ed25519_service_request request;
+
+	request.m = m;
+	request.mlen = mlen;
+	request.pk = pk;
+	request.sk = sk;
+	request.RS = RS;
+	request.callback = callback;
+	request.arg = arg;
+	request.tag = tag;
+	return ed25519_service_submit((ed25519_service *)svc, priority, &request);
+}
+
+int
+ED25519_FN(ed25519_sign_service_submit) (ed25519_sign_service *svc, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag) {
+	return ED25519_FN(ed25519_sign_service_submit_priority) (svc, ED25519_PRIORITY_BULK, m, mlen, sk, pk, RS, callback, arg, tag);
+}
+
+/* blocks until RS is written, signs directly if the queue is full */
+void
+ED25519_FN(ed25519_sign_service_sign_priority) (ed25519_sign_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+	ed25519_service_waiter waiter;
+
+	ed25519_service_waiter_init(&waiter);
+	if (ED25519_FN(ed25519_sign_service_submit_priority) (svc, priority, m, mlen, sk, pk, RS, ed25519_service_wake, &waiter, NULL) != 0) {
+		ED25519_FN(ed25519_sign) (m, mlen, sk, pk, RS);
+		waiter.finished = 1;
+	}
+	ed25519_service_waiter_wait(&waiter);
+}
+
+void
+ED25519_FN(ed25519_sign_service_sign) (ed25519_sign_service *svc, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+	ED25519_FN(ed25519_sign_service_sign_priority) (svc, ED25519_PRIORITY_BULK, m, mlen, sk, pk, RS);
+}
+
+void
+ED25519_FN(ed25519_sign_service_stats) (ed25519_sign_service *svc, int priority, ed25519_service_stats *stats) {
+	ed25519_service_read_stats((ed25519_service *)svc, priority, stats);
+}
+
+#endif /* ED25519_SIGN_SERVICE */
+
+#endif /* ED25519_VERIFY_SERVICE || ED25519_SIGN_SERVICE */
@@ -0,0 +1,282 @@
+/*
+	Two thread verification for latency
+
+	Define ED25519_SPLIT_VERIFY (and link with -lpthread) for a verifier that
+	splits one signature check across the calling thread and a helper thread
+	started with it. Both scalars are split at bit 128,
+
+		[h]A + [S]B = ([h_lo]A + [S_lo]B) + ([h_hi]A' + [S_hi]B'),
+
+	with A' = [2^128]A and B' = [2^128]B, so each thread runs half of the
+	doubling chain and the halves are merged with one point addition. The
+	verifier keeps the tables for A and A' for split_key_cache_size recent keys,
+	the first check under a key pays 128 extra doublings to build them.
+
+	The helper spins for a while on the handoff before it sleeps, so back to
+	back checks do not wait for it to be woken. With fewer than two CPUs online
+	no helper is started and the calling thread computes both halves. A
+	verifier is used by one thread at a time.
+*/
+
+#if defined(ED25519_SPLIT_VERIFY)
+
+#if defined(OS_WINDOWS) || !(defined(COMPILER_GCC) || defined(COMPILER_CLANG))
+	#error ED25519_SPLIT_VERIFY needs pthreads and gcc or clang
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define split_key_cache_size 32
+#define split_spin_count 4096
+
+#if defined(CPU_X86_64) || defined(CPU_X86)
+	#define ed25519_split_pause() __builtin_ia32_pause()
+#else
+	#define ed25519_split_pause()
+#endif
+
+/* the helper waits in idle or done, and takes posted or stop */
+enum ed25519_split_state_t {
+	split_idle = 0,
+	split_posted = 1,
+	split_done = 2,
+	split_stop = 3
+};
+
+/* tables for -A and -A' */
+typedef struct ed25519_split_key_t {
+	ge25519_pniels ALIGN(16) pre[S1_TABLE_SIZE];
+	ge25519_pniels ALIGN(16) pre_hi[S1_TABLE_SIZE];
+	unsigned char pk[32];
+	int used;
+} ed25519_split_key;
+
+struct ed25519_split_verifier_t {
+	size_t ALIGN(64) state;
+	size_t sleeping;
+	int threaded;
+
+	/* the helper's half, [h_hi]A' + [S_hi]B' */
+	const ge25519_pniels *pre_hi;
+	bignum256modm h_hi, S_hi;
+	ge25519 ALIGN(64) half;
+
+	ge25519_pniels ALIGN(16) preB_hi[S1_TABLE_SIZE];
+	ed25519_split_key keys[split_key_cache_size];
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t helper;
+};
+
+/* computes [s1]p1 + [s2]p2, with both tables from ge25519_double_scalarmult_table */
+static void
+ge25519_double_scalarmult_pniels_vartime(ge25519 *r, const ge25519_pniels pre1[S1_TABLE_SIZE], const bignum256modm s1, const ge25519_pniels pre2[S1_TABLE_SIZE], const bignum256modm s2) {
+	signed char slide1[256], slide2[256];
+	ge25519_p1p1 t;
+	int32_t i;
+
+	contract256_slidingwindow_modm(slide1, s1, S1_SWINDOWSIZE);
+	contract256_slidingwindow_modm(slide2, s2, S1_SWINDOWSIZE);
+
+	/* set neutral */
+	memset(r, 0, sizeof(ge25519));
+	r->y[0] = 1;
+	r->z[0] = 1;
+
+	i = 255;
+	while ((i >= 0) && !(slide1[i] | slide2[i]))
+		i--;
+
+	for (; i >= 0; i--) {
+		ge25519_double_p1p1(&t, r);
+
+		if (slide1[i]) {
+			ge25519_p1p1_to_full(r, &t);
+			ge25519_pnielsadd_p1p1(&t, r, &pre1[abs(slide1[i]) / 2], (unsigned char)slide1[i] >> 7);
+		}
+
+		if (slide2[i]) {
+			ge25519_p1p1_to_full(r, &t);
+			ge25519_pnielsadd_p1p1(&t, r, &pre2[abs(slide2[i]) / 2], (unsigned char)slide2[i] >> 7);
+		}
+
+		ge25519_p1p1_to_partial(r, &t);
+	}
+}
+
+/* p = [2^128]p */
+static void
+ge25519_double_128(ge25519 *p) {
+	size_t i;
+	for (i = 0; i < 128; i++)
+		ge25519_double(p, p);
+}
+
+static void *
+ed25519_split_helper(void *arg) {
+	ed25519_split_verifier *v = (ed25519_split_verifier *)arg;
+	size_t state, spins;
+
+	for (;;) {
+		for (spins = 0; spins < split_spin_count; spins++) {
+			state = __atomic_load_n(&v->state, __ATOMIC_ACQUIRE);
+			if ((state == split_posted) || (state == split_stop))
+				break;
+			ed25519_split_pause();
+		}
+
+		if (spins == split_spin_count) {
+			/* the sleeping flag is raised before state is checked again, see ed25519_split_signal */
+			pthread_mutex_lock(&v->lock);
+			__atomic_store_n(&v->sleeping, 1, __ATOMIC_SEQ_CST);
+			for (;;) {
+				state = __atomic_load_n(&v->state, __ATOMIC_SEQ_CST);
+				if ((state == split_posted) || (state == split_stop))
+					break;
+				pthread_cond_wait(&v->wake, &v->lock);
+			}
+			__atomic_store_n(&v->sleeping, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&v->lock);
+		}
+
+		if (state == split_stop)
+			break;
+		ge25519_double_scalarmult_pniels_vartime(&v->half, v->pre_hi, v->h_hi, v->preB_hi, v->S_hi);
+		ge25519_partial_to_full(&v->half);
+		__atomic_store_n(&v->state, split_done, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void
+ed25519_split_signal(ed25519_split_verifier *v, size_t state) {
+	__atomic_store_n(&v->state, state, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&v->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&v->lock);
+		pthread_cond_signal(&v->wake);
+		pthread_mutex_unlock(&v->lock);
+	}
+}
+
+/* spins for the helper's half, yielding once it takes long enough that the helper may not be running */
+static void
+ed25519_split_wait(ed25519_split_verifier *v) {
+	size_t spins;
+
+	for (spins = 0; __atomic_load_n(&v->state, __ATOMIC_ACQUIRE) != split_done; spins++) {
+		if (spins < split_spin_count)
+			ed25519_split_pause();
+		else
+			sched_yield();
+	}
+}
+
+/* the tables for pk, built in to its slot on a miss. NULL if pk is not a valid point */
+static const ed25519_split_key *
+ed25519_split_key_find(ed25519_split_verifier *v, const unsigned char pk[32]) {
+	ed25519_split_key *key = &v->keys[((size_t)pk[0] | ((size_t)pk[1] << 8)) % split_key_cache_size];
+	ge25519 ALIGN(16) A;
+
+	if (key->used && (memcmp(key->pk, pk, 32) == 0))
+		return key;
+
+	key->used = 0;
+	if (!ed25519_unpack_key_vartime(&A, key->pre, pk))
+		return NULL;
+	ge25519_double_128(&A);
+	ge25519_double_scalarmult_table(key->pre_hi, &A);
+	memcpy(key->pk, pk, 32);
+	key->used = 1;
+	return key;
+}
+
+ed25519_split_verifier *
+ED25519_FN(ed25519_split_verifier_create) (void) {
+	ed25519_split_verifier *v;
+	ge25519 ALIGN(16) B;
+	void *memory;
+
+	if (posix_memalign(&memory, 64, sizeof(ed25519_split_verifier)) != 0)
+		return NULL;
+	v = (ed25519_split_verifier *)memory;
+	memset(v, 0, sizeof(ed25519_split_verifier));
+
+	B = ge25519_basepoint;
+	ge25519_double_128(&B);
+	ge25519_double_scalarmult_table(v->preB_hi, &B);
+
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+		return v;
+
+	pthread_mutex_init(&v->lock, NULL);
+	pthread_cond_init(&v->wake, NULL);
+	if (pthread_create(&v->helper, NULL, ed25519_split_helper, v) != 0) {
+		pthread_cond_destroy(&v->wake);
+		pthread_mutex_destroy(&v->lock);
+		free(v);
+		return NULL;
+	}
+	v->threaded = 1;
+	return v;
+}
+
+void
+ED25519_FN(ed25519_split_verifier_destroy) (ed25519_split_verifier *v) {
+	if (v->threaded) {
+		ed25519_split_signal(v, split_stop);
+		pthread_join(v->helper, NULL);
+		pthread_cond_destroy(&v->wake);
+		pthread_mutex_destroy(&v->lock);
+	}
+	free(v);
+}
+
+int
+ED25519_FN(ed25519_split_verifier_sign_open) (ed25519_split_verifier *v, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS) {
+	const ed25519_split_key *key;
+	hash_512bits hash;
+	bignum256modm h, h_lo, S_lo;
+	ge25519 ALIGN(16) R;
+	unsigned char hb[32];
+	int ret;
+
+	/* hram = H(R,A,m) */
+	ed25519_hram(hash, RS, pk, m, mlen);
+	if (ed25519_verify_cache_find(&ret, hash, RS))
+		return ret;
+
+	ret = -1;
+	if (!ed25519_signature_s_invalid(RS) && (key = ed25519_split_key_find(v, pk))) {
+		/* h = h_lo + 2^128 h_hi, S = S_lo + 2^128 S_hi */
+		expand256_modm(h, hash, 64);
+		contract256_modm(hb, h);
+		expand256_modm(h_lo, hb, 16);
+		expand256_modm(v->h_hi, hb + 16, 16);
+		expand256_modm(S_lo, RS + 32, 16);
+		expand256_modm(v->S_hi, RS + 48, 16);
+		v->pre_hi = key->pre_hi;
+		if (v->threaded)
+			ed25519_split_signal(v, split_posted);
+
+		/* SB - H(R,A,m)A, the low half here */
+		ge25519_double_scalarmult_table_vartime(&R, key->pre, h_lo, S_lo);
+		ge25519_partial_to_full(&R);
+		if (v->threaded) {
+			ed25519_split_wait(v);
+		} else {
+			ge25519_double_scalarmult_pniels_vartime(&v->half, v->pre_hi, v->h_hi, v->preB_hi, v->S_hi);
+			ge25519_partial_to_full(&v->half);
+		}
+		ge25519_add(&R, &R, &v->half);
+
+		/* check that R = SB - H(R,A,m)A */
+		ret = ed25519_verify_R_vartime(&R, RS) ? 0 : -1;
+	}
+
+	ed25519_verify_cache_insert(hash, RS, ret);
+	return ret;
+}
+
+#endif /* ED25519_SPLIT_VERIFY */
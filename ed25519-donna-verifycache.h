@@ -0,0 +1,223 @@
+/*
+	Verification result memo
+
+	Define ED25519_VERIFY_CACHE to remember the outcome of recent verifications,
+	so a signature that arrives again (gossip, retransmits) costs a hash instead
+	of a double scalar multiplication. Entries are keyed by S and H(R,A,m), which
+	binds R, A and m, and live in an open addressed table split in to
+	ED25519_VERIFY_CACHE_SHARDS shards of ED25519_VERIFY_CACHE_SLOTS slots, each
+	shard with its own lock.
+
+	Every entry records the shard epoch it was written in, and the epoch advances
+	after every SLOTS/2 inserts. Valid results live for two epochs, failures only
+	for the current one. Failures never displace a valid result and at most
+	SLOTS/16 are cached per epoch, so a flood of bad signatures cannot push out
+	good ones or grow the failure set.
+*/
+
+#if defined(ED25519_VERIFY_CACHE)
+
+#if !defined(ED25519_VERIFY_CACHE_SHARDS)
+	#define ED25519_VERIFY_CACHE_SHARDS 16
+#endif
+
+#if !defined(ED25519_VERIFY_CACHE_SLOTS)
+	#define ED25519_VERIFY_CACHE_SLOTS 256
+#endif
+
+/* slots probed from the home slot on a lookup or insert */
+#if !defined(ED25519_VERIFY_CACHE_PROBES)
+	#define ED25519_VERIFY_CACHE_PROBES 8
+#endif
+
+enum ed25519_verify_cache_state_t {
+	ed25519_verify_cache_empty = 0,
+	ed25519_verify_cache_valid = 1,
+	ed25519_verify_cache_invalid = 2
+};
+
+typedef struct ed25519_verify_cache_entry_t {
+	unsigned char hram[64];
+	unsigned char S[32];
+	uint32_t epoch;
+	unsigned char state;
+} ed25519_verify_cache_entry;
+
+typedef struct ed25519_verify_cache_shard_t {
+	ed25519_verify_cache_entry entries[ED25519_VERIFY_CACHE_SLOTS];
+	ed25519_cache_lock_t lock;
+	uint32_t epoch;
+	size_t inserts, failures, hits, misses;
+} ed25519_verify_cache_shard;
+
+static ed25519_verify_cache_shard ed25519_verify_cache[ED25519_VERIFY_CACHE_SHARDS];
+
+#if !defined(OS_WINDOWS)
+static pthread_once_t ed25519_verify_cache_once = PTHREAD_ONCE_INIT;
+
+static void
+ed25519_verify_cache_init(void) {
+	size_t i;
+	for (i = 0; i < ED25519_VERIFY_CACHE_SHARDS; i++)
+		pthread_mutex_init(&ed25519_verify_cache[i].lock, NULL);
+}
+#endif
+
+static ed25519_verify_cache_shard *
+ed25519_verify_cache_get_shard(size_t i) {
+#if !defined(OS_WINDOWS)
+	pthread_once(&ed25519_verify_cache_once, ed25519_verify_cache_init);
+#endif
+	return &ed25519_verify_cache[i];
+}
+
+/* H(R,A,m) is already a hash, the shard and home slot come from separate words of it */
+static size_t
+ed25519_verify_cache_word(const unsigned char *p) {
+	return (size_t)p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+}
+
+static int
+ed25519_verify_cache_live(const ed25519_verify_cache_shard *shard, const ed25519_verify_cache_entry *e) {
+	switch (e->state) {
+		case ed25519_verify_cache_valid: return (uint32_t)(shard->epoch - e->epoch) < 2;
+		case ed25519_verify_cache_invalid: return e->epoch == shard->epoch;
+		default: return 0;
+	}
+}
+
+static int
+ed25519_verify_cache_match(const ed25519_verify_cache_entry *e, const unsigned char hram[64], const unsigned char RS[64]) {
+	return (memcmp(e->hram, hram, 64) == 0) && (memcmp(e->S, RS + 32, 32) == 0);
+}
+
+/* 1 and *result = 0 (valid) or -1 (invalid) on a hit, 0 on a miss */
+static int
+ed25519_verify_cache_find(int *result, const unsigned char hram[64], const unsigned char RS[64]) {
+	ed25519_verify_cache_shard *shard = ed25519_verify_cache_get_shard(ed25519_verify_cache_word(hram + 4) % ED25519_VERIFY_CACHE_SHARDS);
+	size_t home = ed25519_verify_cache_word(hram), i;
+	ed25519_verify_cache_entry *e;
+	int found = 0;
+
+	ed25519_cache_lock(&shard->lock);
+	for (i = 0; i < ED25519_VERIFY_CACHE_PROBES; i++) {
+		e = &shard->entries[(home + i) % ED25519_VERIFY_CACHE_SLOTS];
+		if (ed25519_verify_cache_live(shard, e) && ed25519_verify_cache_match(e, hram, RS)) {
+			*result = (e->state == ed25519_verify_cache_valid) ? 0 : -1;
+			found = 1;
+			break;
+		}
+	}
+	if (found)
+		shard->hits++;
+	else
+		shard->misses++;
+	ed25519_cache_unlock(&shard->lock);
+	return found;
+}
+
+/*
+	slot preference: the same key, a dead slot, then (for valid results only)
+	a live failure and finally the oldest valid result
+*/
+static void
+ed25519_verify_cache_insert(const unsigned char hram[64], const unsigned char RS[64], int result) {
+	ed25519_verify_cache_shard *shard = ed25519_verify_cache_get_shard(ed25519_verify_cache_word(hram + 4) % ED25519_VERIFY_CACHE_SHARDS);
+	size_t home = ed25519_verify_cache_word(hram), i;
+	ed25519_verify_cache_entry *e, *dead = NULL, *failure = NULL, *oldest = NULL;
+	unsigned char state = (result == 0) ? ed25519_verify_cache_valid : ed25519_verify_cache_invalid;
+
+	ed25519_cache_lock(&shard->lock);
+	if ((state == ed25519_verify_cache_invalid) && (shard->failures >= (ED25519_VERIFY_CACHE_SLOTS / 16)))
+		goto done;
+
+	for (i = 0; i < ED25519_VERIFY_CACHE_PROBES; i++) {
+		e = &shard->entries[(home + i) % ED25519_VERIFY_CACHE_SLOTS];
+		if (!ed25519_verify_cache_live(shard, e)) {
+			if (!dead)
+				dead = e;
+		} else if (ed25519_verify_cache_match(e, hram, RS)) {
+			/* another thread got here first */
+			goto done;
+		} else if (e->state == ed25519_verify_cache_invalid) {
+			if (!failure)
+				failure = e;
+		} else if (!oldest || ((uint32_t)(shard->epoch - e->epoch) > (uint32_t)(shard->epoch - oldest->epoch))) {
+			oldest = e;
+		}
+	}
+
+	e = dead;
+	if (!e && (state == ed25519_verify_cache_valid))
+		e = failure ? failure : oldest;
+	if (!e)
+		goto done;
+
+	memcpy(e->hram, hram, 64);
+	memcpy(e->S, RS + 32, 32);
+	e->epoch = shard->epoch;
+	e->state = state;
+	if (state == ed25519_verify_cache_invalid)
+		shard->failures++;
+
+	/* failures from the previous epoch are dead now, so the count restarts */
+	if (++shard->inserts == (ED25519_VERIFY_CACHE_SLOTS / 2)) {
+		shard->inserts = 0;
+		shard->failures = 0;
+		shard->epoch++;
+	}
+
+done:
+	ed25519_cache_unlock(&shard->lock);
+}
+
+/* hits and misses summed over every shard, both wrap around */
+void
+ED25519_FN(ed25519_verify_cache_stats) (size_t *hits, size_t *misses) {
+	ed25519_verify_cache_shard *shard;
+	size_t i;
+
+	*hits = 0;
+	*misses = 0;
+	for (i = 0; i < ED25519_VERIFY_CACHE_SHARDS; i++) {
+		shard = ed25519_verify_cache_get_shard(i);
+		ed25519_cache_lock(&shard->lock);
+		*hits += shard->hits;
+		*misses += shard->misses;
+		ed25519_cache_unlock(&shard->lock);
+	}
+}
+
+/* drops every cached result and resets the counters */
+void
+ED25519_FN(ed25519_verify_cache_clear) (void) {
+	ed25519_verify_cache_shard *shard;
+	size_t i, j;
+
+	for (i = 0; i < ED25519_VERIFY_CACHE_SHARDS; i++) {
+		shard = ed25519_verify_cache_get_shard(i);
+		ed25519_cache_lock(&shard->lock);
+		for (j = 0; j < ED25519_VERIFY_CACHE_SLOTS; j++)
+			shard->entries[j].state = ed25519_verify_cache_empty;
+		shard->inserts = 0;
+		shard->failures = 0;
+		shard->hits = 0;
+		shard->misses = 0;
+		ed25519_cache_unlock(&shard->lock);
+	}
+}
+
+#else
+
+static int
+ed25519_verify_cache_find(int *result, const unsigned char hram[64], const unsigned char RS[64]) {
+	(void)result; (void)hram; (void)RS;
+	return 0;
+}
+
+static void
+ed25519_verify_cache_insert(const unsigned char hram[64], const unsigned char RS[64], int result) {
+	(void)hram; (void)RS; (void)result;
+}
+
+#endif /* ED25519_VERIFY_CACHE */
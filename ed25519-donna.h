@@ -113,3 +113,6 @@ typedef struct ge25519_pniels_t {
 	#include "ed25519-donna-impl-base.h"
 #endif
 
+#include "ed25519-donna-fixedbase.h"
+#include "ed25519-donna-multiscalarmult.h"
+
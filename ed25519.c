@@ -18,6 +18,8 @@
 #include "ed25519.h"
 #include "ed25519-randombytes.h"
 #include "ed25519-hash.h"
+#include "ed25519-donna-keycache.h"
+#include "ed25519-donna-verifycache.h"
 
 /*
 	Generates a (extsk[0..31]) and aExt (extsk[32..63])
@@ -31,16 +33,58 @@ ed25519_extsk(hash_512bits extsk, const ed25519_secret_key sk) {
 	extsk[31] |= 64;
 }
 
+/*
+	dom2(phflag, context) from RFC 8032, hashed in front of both hashes by
+	Ed25519ph and Ed25519ctx. Plain Ed25519 passes NULL
+*/
+
+typedef struct ed25519_dom2_t {
+	unsigned char prefix[34];
+	const unsigned char *ctx;
+	size_t ctxlen;
+} ed25519_dom2;
+
+/* 0 if the context is longer than the 255 bytes dom2 can encode */
+static int
+ed25519_dom2_init(ed25519_dom2 *dom, unsigned char phflag, const unsigned char *ctx, size_t ctxlen) {
+	memcpy(dom->prefix, "SigEd25519 no Ed25519 collisions", 32);
+	dom->prefix[32] = phflag;
+	dom->prefix[33] = (unsigned char)ctxlen;
+	dom->ctx = ctx;
+	dom->ctxlen = ctxlen;
+	return ctxlen <= 255;
+}
+
 static void
-ed25519_hram(hash_512bits hram, const ed25519_signature RS, const ed25519_public_key pk, const unsigned char *m, size_t mlen) {
+ed25519_hash_dom2(ed25519_hash_context *hctx, const ed25519_dom2 *dom) {
+	if (!dom)
+		return;
+	ed25519_hash_update(hctx, dom->prefix, 34);
+	if (dom->ctxlen)
+		ed25519_hash_update(hctx, dom->ctx, dom->ctxlen);
+}
+
+static void
+ed25519_hram_iov(hash_512bits hram, const ed25519_dom2 *dom, const ed25519_signature RS, const ed25519_public_key pk, const ed25519_iovec *iov, size_t iovcnt) {
 	ed25519_hash_context ctx;
+	size_t i;
 	ed25519_hash_init(&ctx);
+	ed25519_hash_dom2(&ctx, dom);
 	ed25519_hash_update(&ctx, RS, 32);
 	ed25519_hash_update(&ctx, pk, 32);
-	ed25519_hash_update(&ctx, m, mlen);
+	for (i = 0; i < iovcnt; i++)
+		ed25519_hash_update(&ctx, (const unsigned char *)iov[i].iov_base, iov[i].iov_len);
 	ed25519_hash_final(&ctx, hram);
 }
 
+static void
+ed25519_hram(hash_512bits hram, const ed25519_signature RS, const ed25519_public_key pk, const unsigned char *m, size_t mlen) {
+	ed25519_iovec iov;
+	iov.iov_base = m;
+	iov.iov_len = mlen;
+	ed25519_hram_iov(hram, NULL, RS, pk, &iov, 1);
+}
+
 void
 ED25519_FN(ed25519_publickey) (const ed25519_secret_key sk, ed25519_public_key pk) {
 	bignum256modm a;
@@ -55,19 +99,22 @@ ED25519_FN(ed25519_publickey) (const ed25519_secret_key sk, ed25519_public_key p
 }
 
 
-void
-ED25519_FN(ed25519_sign) (const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+static void
+ed25519_sign_dom2(const ed25519_dom2 *dom, const ed25519_iovec *iov, size_t iovcnt, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
 	ed25519_hash_context ctx;
 	bignum256modm r, S, a;
 	ge25519 ALIGN(16) R;
 	hash_512bits extsk, hashr, hram;
+	size_t i;
 
 	ed25519_extsk(extsk, sk);
 
 	/* r = H(aExt[32..64], m) */
 	ed25519_hash_init(&ctx);
+	ed25519_hash_dom2(&ctx, dom);
 	ed25519_hash_update(&ctx, extsk + 32, 32);
-	ed25519_hash_update(&ctx, m, mlen);
+	for (i = 0; i < iovcnt; i++)
+		ed25519_hash_update(&ctx, (const unsigned char *)iov[i].iov_base, iov[i].iov_len);
 	ed25519_hash_final(&ctx, hashr);
 	expand256_modm(r, hashr, 64);
 
@@ -76,7 +123,7 @@ ED25519_FN(ed25519_sign) (const unsigned char *m, size_t mlen, const ed25519_sec
 	ge25519_pack(RS, &R);
 
 	/* S = H(R,A,m).. */
-	ed25519_hram(hram, RS, pk, m, mlen);
+	ed25519_hram_iov(hram, dom, RS, pk, iov, iovcnt);
 	expand256_modm(S, hram, 64);
 
 	/* S = H(R,A,m)a */
@@ -90,32 +137,527 @@ ED25519_FN(ed25519_sign) (const unsigned char *m, size_t mlen, const ed25519_sec
 	contract256_modm(RS + 32, S);
 }
 
-int
-ED25519_FN(ed25519_sign_open) (const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS) {
+void
+ED25519_FN(ed25519_sign_iov) (const ed25519_iovec *iov, size_t iovcnt, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+	ed25519_sign_dom2(NULL, iov, iovcnt, sk, pk, RS);
+}
+
+void
+ED25519_FN(ed25519_sign) (const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+	ed25519_iovec iov;
+	iov.iov_base = m;
+	iov.iov_len = mlen;
+	ED25519_FN(ed25519_sign_iov) (&iov, 1, sk, pk, RS);
+}
+
+/*
+	Signs num messages under any mix of keys, sign_batch_size at a time. Encoding
+	R needs 1/Z, and Montgomery's trick gets every 1/Z in a group from a single
+	inversion: with acc[i] = Z[0]..Z[i], 1/Z[i] = acc[i-1] / acc[i]. Only
+	multiplications are added, so signing stays constant time
+*/
+
+#define sign_batch_size 16
+
+void
+ED25519_FN(ed25519_sign_batch) (const unsigned char **m, size_t *mlen, const unsigned char **sk, const unsigned char **pk, unsigned char **RS, size_t num) {
+	ed25519_hash_context ctx;
+	bignum256modm r[sign_batch_size], S, a;
+	ge25519 ALIGN(16) R[sign_batch_size];
+	bignum25519 ALIGN(16) acc[sign_batch_size], zi, tx, ty;
+	hash_512bits extsk[sign_batch_size], hashr, hram;
+	unsigned char parity[32];
+	size_t i, n;
+
+	for (; num; m += n, mlen += n, sk += n, pk += n, RS += n, num -= n) {
+		n = (num > sign_batch_size) ? sign_batch_size : num;
+
+		/* R = rB, with r = H(aExt[32..64], m) */
+		for (i = 0; i < n; i++) {
+			ed25519_extsk(extsk[i], sk[i]);
+			ed25519_hash_init(&ctx);
+			ed25519_hash_update(&ctx, extsk[i] + 32, 32);
+			ed25519_hash_update(&ctx, m[i], mlen[i]);
+			ed25519_hash_final(&ctx, hashr);
+			expand256_modm(r[i], hashr, 64);
+			ge25519_scalarmult_base_niels(&R[i], ge25519_niels_base_multiples, r[i]);
+		}
+
+		/* acc[i] = Z[0]..Z[i], zi = 1/acc[n-1] */
+		curve25519_copy(acc[0], R[0].z);
+		for (i = 1; i < n; i++)
+			curve25519_mul(acc[i], acc[i - 1], R[i].z);
+		curve25519_recip(zi, acc[n - 1]);
+
+		/* acc[i] = 1/Z[i], zi = 1/acc[i-1] */
+		for (i = n - 1; i > 0; i--) {
+			curve25519_mul(tx, zi, acc[i - 1]);
+			curve25519_mul(zi, zi, R[i].z);
+			curve25519_copy(acc[i], tx);
+		}
+		curve25519_copy(acc[0], zi);
+
+		for (i = 0; i < n; i++) {
+			/* the encoding of R, as ge25519_pack */
+			curve25519_mul(tx, R[i].x, acc[i]);
+			curve25519_mul(ty, R[i].y, acc[i]);
+			curve25519_contract(RS[i], ty);
+			curve25519_contract(parity, tx);
+			RS[i][31] ^= ((parity[0] & 1) << 7);
+
+			/* S = (r + H(R,A,m)a) mod L */
+			ed25519_hram(hram, RS[i], pk[i], m[i], mlen[i]);
+			expand256_modm(S, hram, 64);
+			expand256_modm(a, extsk[i], 32);
+			mul256_modm(S, S, a);
+			add256_modm(S, S, r[i]);
+			contract256_modm(RS[i] + 32, S);
+		}
+	}
+}
+
+/*
+	Verification equation
+
+	By default a signature is checked as in the reference code: S under 2^253 and
+	the encoding of SB - H(R,A,m)A equal to the bytes of R. Define ED25519_COFACTORED
+	to check [8]R = [8](SB - H(R,A,m)A) instead, with S fully reduced and R and A
+	accepted in any encoding that decompresses, as ZIP-215. Batch verification
+	checks the same equation, so a signature is valid alone exactly when it is
+	valid in a batch, small order components included
+*/
+
+#if defined(ED25519_TEST)
+/* not actually used for anything other than testing */
+unsigned char batch_point_buffer[3][32];
+#endif
+
+static int
+ge25519_is_neutral_vartime(const ge25519 *p) {
+	static const unsigned char zero[32] = {0};
+	unsigned char point_buffer[3][32];
+	curve25519_contract(point_buffer[0], p->x);
+	curve25519_contract(point_buffer[1], p->y);
+	curve25519_contract(point_buffer[2], p->z);
+#if defined(ED25519_TEST)
+	memcpy(batch_point_buffer[1], point_buffer[1], 32);
+#endif
+	return (memcmp(point_buffer[0], zero, 32) == 0) && (memcmp(point_buffer[1], point_buffer[2], 32) == 0);
+}
+
+/* fills in t for a point left with x, y and z only, (x:y:z) = (xz:yz:zz:xy) */
+DONNA_INLINE static void
+ge25519_partial_to_full(ge25519 *p) {
+	curve25519_mul(p->t, p->x, p->y);
+	curve25519_mul(p->x, p->x, p->z);
+	curve25519_mul(p->y, p->y, p->z);
+	curve25519_square(p->z, p->z);
+}
+
+/* 1 if S is out of range, before any curve work */
+static int
+ed25519_signature_s_invalid(const ed25519_signature RS) {
+#if defined(ED25519_COFACTORED)
+	/* l = 2^252 + 27742317777372353535851937790883648493, little endian */
+	static const unsigned char l[32] = {
+		0xed,0xd3,0xf5,0x5c,0x1a,0x63,0x12,0x58,0xd6,0x9c,0xf7,0xa2,0xde,0xf9,0xde,0x14,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10
+	};
+	size_t i;
+
+	/* S is public, so the comparison may return early */
+	for (i = 32; i-- > 0; ) {
+		if (RS[32 + i] != l[i])
+			return RS[32 + i] > l[i];
+	}
+	return 1;
+#else
+	return (RS[63] & 224) ? 1 : 0;
+#endif
+}
+
+/* 1 if P, SB - H(R,A,m)A in projective coordinates, matches R. P is clobbered */
+static int
+ed25519_verify_R_vartime(ge25519 *P, const unsigned char R[32]) {
+#if defined(ED25519_COFACTORED)
+	ge25519 ALIGN(16) negR;
+
+	if (!ge25519_unpack_negative_vartime(&negR, R))
+		return 0;
+	ge25519_partial_to_full(P);
+	ge25519_add(P, P, &negR);
+	ge25519_double_partial(P, P);
+	ge25519_double_partial(P, P);
+	ge25519_double_partial(P, P);
+	return ge25519_is_neutral_vartime(P);
+#else
+	unsigned char checkR[32];
+
+	ge25519_pack(checkR, P);
+	return ed25519_verify(R, checkR, 32);
+#endif
+}
+
+/* verify RS against pk once H(R,A,m) is known, and remember the result */
+static int
+ed25519_sign_open_hram(const hash_512bits hash, const ed25519_public_key pk, const ed25519_signature RS) {
 	ge25519 ALIGN(16) R, A;
-	hash_512bits hash;
+	ge25519_pniels ALIGN(16) preA[S1_TABLE_SIZE];
 	bignum256modm hram, S;
-	unsigned char checkR[32];
+	int ret = -1;
 
-	if ((RS[63] & 224) || !ge25519_unpack_negative_vartime(&A, pk))
-		return -1;
+	if (!ed25519_signature_s_invalid(RS) && ed25519_unpack_key_vartime(&A, preA, pk)) {
+		expand256_modm(hram, hash, 64);
+
+		/* S */
+		expand256_modm(S, RS + 32, 32);
+
+		/* SB - H(R,A,m)A */
+		ge25519_double_scalarmult_table_vartime(&R, preA, hram, S);
+
+		/* check that R = SB - H(R,A,m)A */
+		ret = ed25519_verify_R_vartime(&R, RS) ? 0 : -1;
+	}
+
+	ed25519_verify_cache_insert(hash, RS, ret);
+	return ret;
+}
+
+int
+ED25519_FN(ed25519_sign_open) (const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS) {
+	hash_512bits hash;
+	int ret;
 
 	/* hram = H(R,A,m) */
 	ed25519_hram(hash, RS, pk, m, mlen);
-	expand256_modm(hram, hash, 64);
+	if (ed25519_verify_cache_find(&ret, hash, RS))
+		return ret;
+	return ed25519_sign_open_hram(hash, pk, RS);
+}
+
+static int
+ed25519_sign_open_dom2(const ed25519_dom2 *dom, const ed25519_iovec *iov, size_t iovcnt, const ed25519_public_key pk, const ed25519_signature RS) {
+	hash_512bits hash;
+	int ret;
+
+	ed25519_hram_iov(hash, dom, RS, pk, iov, iovcnt);
+	if (ed25519_verify_cache_find(&ret, hash, RS))
+		return ret;
+	return ed25519_sign_open_hram(hash, pk, RS);
+}
+
+int
+ED25519_FN(ed25519_sign_open_iov) (const ed25519_iovec *iov, size_t iovcnt, const ed25519_public_key pk, const ed25519_signature RS) {
+	return ed25519_sign_open_dom2(NULL, iov, iovcnt, pk, RS);
+}
+
+/*
+	Streaming verification
+
+	H(R,A,m) is the only pass over m, so it can be fed in pieces and the check
+	deferred to ed25519_sign_open_final
+*/
+
+typedef struct ed25519_sign_open_state_t {
+	ed25519_hash_context hash;
+	ed25519_public_key pk;
+	ed25519_signature RS;
+} ed25519_sign_open_state;
+
+/* fails to compile if the hash state outgrows ed25519_sign_open_context */
+typedef char ed25519_sign_open_context_too_small[(sizeof(ed25519_sign_open_state) <= sizeof(ed25519_sign_open_context)) ? 1 : -1];
+
+void
+ED25519_FN(ed25519_sign_open_init) (ed25519_sign_open_context *ctx, const ed25519_public_key pk, const ed25519_signature RS) {
+	ed25519_sign_open_state *st = (ed25519_sign_open_state *)ctx->opaque;
+	memcpy(st->pk, pk, 32);
+	memcpy(st->RS, RS, 64);
+	ed25519_hash_init(&st->hash);
+	ed25519_hash_update(&st->hash, RS, 32);
+	ed25519_hash_update(&st->hash, pk, 32);
+}
+
+void
+ED25519_FN(ed25519_sign_open_update) (ed25519_sign_open_context *ctx, const unsigned char *m, size_t mlen) {
+	ed25519_sign_open_state *st = (ed25519_sign_open_state *)ctx->opaque;
+	ed25519_hash_update(&st->hash, m, mlen);
+}
+
+int
+ED25519_FN(ed25519_sign_open_final) (ed25519_sign_open_context *ctx) {
+	ed25519_sign_open_state *st = (ed25519_sign_open_state *)ctx->opaque;
+	hash_512bits hash;
+	int ret;
+
+	ed25519_hash_final(&st->hash, hash);
+	if (ed25519_verify_cache_find(&ret, hash, st->RS))
+		return ret;
+	return ed25519_sign_open_hram(hash, st->pk, st->RS);
+}
+
+/*
+	Split phase verification
 
-	/* S */
-	expand256_modm(S, RS + 32, 32);
+	The hash stage is the only pass over m and leaves H(R,A,m) reduced mod l in the
+	record. The curve stage hashes h || 0 in to the verify cache key, which expands to
+	the same scalar
+*/
+
+int
+ED25519_FN(ed25519_sign_open_prepare_iov) (const ed25519_iovec *iov, size_t iovcnt, const ed25519_public_key pk, const ed25519_signature RS, ed25519_prepared_signature *prepared) {
+	hash_512bits hash;
+	bignum256modm h;
+
+	ed25519_hram_iov(hash, NULL, RS, pk, iov, iovcnt);
+	expand256_modm(h, hash, 64);
+	contract256_modm(prepared->h, h);
+	memcpy(prepared->RS, RS, 64);
+	memcpy(prepared->pk, pk, 32);
+	return ed25519_signature_s_invalid(RS) ? -1 : 0;
+}
+
+int
+ED25519_FN(ed25519_sign_open_prepare) (const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, ed25519_prepared_signature *prepared) {
+	ed25519_iovec iov;
+	iov.iov_base = m;
+	iov.iov_len = mlen;
+	return ED25519_FN(ed25519_sign_open_prepare_iov) (&iov, 1, pk, RS, prepared);
+}
+
+static void
+ed25519_prepared_hash(hash_512bits hash, const ed25519_prepared_signature *prepared) {
+	memcpy(hash, prepared->h, 32);
+	memset(hash + 32, 0, 32);
+}
+
+int
+ED25519_FN(ed25519_sign_open_prepared) (const ed25519_prepared_signature *prepared) {
+	hash_512bits hash;
+	int ret;
+
+	ed25519_prepared_hash(hash, prepared);
+	if (ed25519_verify_cache_find(&ret, hash, prepared->RS))
+		return ret;
+	return ed25519_sign_open_hram(hash, prepared->pk, prepared->RS);
+}
+
+/*
+	Ed25519ph and Ed25519ctx (RFC 8032)
+
+	Ed25519ph signs PH(m) = SHA-512(m) instead of m, so a message is read once
+	whether it is signed or verified: ed25519ph_init/update/final compute the
+	prehash in pieces. Ed25519ctx signs m itself under a context string. Both
+	bind a context of at most 255 bytes and return -1 for anything longer
+*/
+
+/* fails to compile if the hash state outgrows ed25519ph_context */
+typedef char ed25519ph_context_too_small[(sizeof(ed25519_hash_context) <= sizeof(ed25519ph_context)) ? 1 : -1];
+
+void
+ED25519_FN(ed25519ph_init) (ed25519ph_context *ph) {
+	ed25519_hash_init((ed25519_hash_context *)ph->opaque);
+}
 
-	/* SB - H(R,A,m)A */
-	ge25519_double_scalarmult_vartime(&R, &A, hram, S);
-	ge25519_pack(checkR, &R);
+void
+ED25519_FN(ed25519ph_update) (ed25519ph_context *ph, const unsigned char *m, size_t mlen) {
+	ed25519_hash_update((ed25519_hash_context *)ph->opaque, m, mlen);
+}
+
+void
+ED25519_FN(ed25519ph_final) (ed25519ph_context *ph, unsigned char prehash[64]) {
+	ed25519_hash_final((ed25519_hash_context *)ph->opaque, prehash);
+}
+
+int
+ED25519_FN(ed25519ph_sign) (const unsigned char prehash[64], const unsigned char *ctx, size_t ctxlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+	ed25519_dom2 dom;
+	ed25519_iovec iov;
+
+	if (!ed25519_dom2_init(&dom, 1, ctx, ctxlen))
+		return -1;
+	iov.iov_base = prehash;
+	iov.iov_len = 64;
+	ed25519_sign_dom2(&dom, &iov, 1, sk, pk, RS);
+	return 0;
+}
+
+int
+ED25519_FN(ed25519ph_sign_open) (const unsigned char prehash[64], const unsigned char *ctx, size_t ctxlen, const ed25519_public_key pk, const ed25519_signature RS) {
+	ed25519_dom2 dom;
+	ed25519_iovec iov;
 
-	/* check that R = SB - H(R,A,m)A */
-	return ed25519_verify(RS, checkR, 32) ? 0 : -1;
+	if (!ed25519_dom2_init(&dom, 1, ctx, ctxlen))
+		return -1;
+	iov.iov_base = prehash;
+	iov.iov_len = 64;
+	return ed25519_sign_open_dom2(&dom, &iov, 1, pk, RS);
+}
+
+int
+ED25519_FN(ed25519ctx_sign) (const unsigned char *m, size_t mlen, const unsigned char *ctx, size_t ctxlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS) {
+	ed25519_dom2 dom;
+	ed25519_iovec iov;
+
+	if (!ed25519_dom2_init(&dom, 0, ctx, ctxlen))
+		return -1;
+	iov.iov_base = m;
+	iov.iov_len = mlen;
+	ed25519_sign_dom2(&dom, &iov, 1, sk, pk, RS);
+	return 0;
+}
+
+int
+ED25519_FN(ed25519ctx_sign_open) (const unsigned char *m, size_t mlen, const unsigned char *ctx, size_t ctxlen, const ed25519_public_key pk, const ed25519_signature RS) {
+	ed25519_dom2 dom;
+	ed25519_iovec iov;
+
+	if (!ed25519_dom2_init(&dom, 0, ctx, ctxlen))
+		return -1;
+	iov.iov_base = m;
+	iov.iov_len = mlen;
+	return ed25519_sign_open_dom2(&dom, &iov, 1, pk, RS);
 }
 
 #include "ed25519-donna-batchverify.h"
+#include "ed25519-donna-service.h"
+#include "ed25519-donna-splitverify.h"
+#include "ed25519-donna-noncepool.h"
+
+/*
+	Constant time variable base scalar multiplication, out = [e]p
+
+	e is reduced mod l and is treated as secret, p is public. Returns -1
+	if p is not a valid point
+*/
+
+int
+ED25519_FN(ed25519_scalarmult) (ed25519_public_key out, const unsigned char e[32], const ed25519_public_key p) {
+	bignum256modm s;
+	bignum25519 ALIGN(16) neg;
+	ge25519 ALIGN(16) P, R;
+
+	if (!ge25519_unpack_negative_vartime(&P, p))
+		return -1;
+
+	expand256_modm(s, e, 32);
+	ge25519_scalarmult(&R, &P, s);
+
+	/* P was unpacked as -p, so R = -[e]p */
+	curve25519_copy(neg, R.x);
+	curve25519_neg(R.x, neg);
+	ge25519_pack(out, &R);
+	return 0;
+}
+
+/*
+	Multi-scalar multiplication, out = [e[0]]p[0] + [e[1]]p[1] + .. + [e[num-1]]p[num-1]
+
+	ed25519_multi_scalarmult is constant time in the scalars, the _vartime version
+	picks the fastest engine for the whole input. The decoded points, scalars and
+	the engines' scratch are allocated together. Returns -1 if any point is
+	invalid or the allocation fails
+*/
+
+typedef char ed25519_multi_scalarmult_points_aligned[(((sizeof(batch_heap) & 63) == 0) && ((sizeof(ge25519_msm_scratch) & 15) == 0) && ((sizeof(ge25519) & 15) == 0)) ? 1 : -1];
+
+static int
+ed25519_multi_scalarmult_decoded(ed25519_public_key out, const unsigned char **e, const unsigned char **p, size_t num, int vartime) {
+	size_t heapsize = vartime ? (sizeof(batch_heap) + sizeof(ge25519_msm_scratch)) : 0, size, i;
+	unsigned char *memory, *aligned;
+	batch_heap *heap;
+	ge25519 *points;
+	bignum256modm *scalars;
+	ge25519 ALIGN(16) r;
+	bignum25519 ALIGN(16) neg;
+	int ret = -1;
+
+	if (num > (((size_t)-1 - heapsize - 63) / (sizeof(ge25519) + sizeof(bignum256modm))))
+		return -1;
+	size = heapsize + (num * (sizeof(ge25519) + sizeof(bignum256modm)));
+	memory = (unsigned char *)malloc(size + 63);
+	if (!memory)
+		return -1;
+
+	/* the heap is 64 byte aligned, and its size and the tables' keep what follows 16 byte aligned */
+	aligned = (unsigned char *)ed25519_batch_align(memory, size + 63, size);
+	heap = (batch_heap *)aligned;
+	if (vartime)
+		heap->scratch = (ge25519_msm_scratch *)(aligned + sizeof(batch_heap));
+	points = (ge25519 *)(aligned + heapsize);
+	scalars = (bignum256modm *)(aligned + heapsize + (num * sizeof(ge25519)));
+
+	for (i = 0; i < num; i++) {
+		if (!ge25519_unpack_negative_vartime(&points[i], p[i]))
+			goto done;
+		expand256_modm(scalars[i], e[i], 32);
+	}
+
+	if (vartime)
+		ge25519_multi_scalarmult_vartime(&r, points, (const bignum256modm *)scalars, num, heap);
+	else
+		ge25519_multi_scalarmult(&r, points, (const bignum256modm *)scalars, num);
+
+	/* the points were unpacked negated */
+	curve25519_copy(neg, r.x);
+	curve25519_neg(r.x, neg);
+	ge25519_pack(out, &r);
+	ret = 0;
+
+done:
+	free(memory);
+	return ret;
+}
+
+int
+ED25519_FN(ed25519_multi_scalarmult) (ed25519_public_key out, const unsigned char **e, const unsigned char **p, size_t num) {
+	return ed25519_multi_scalarmult_decoded(out, e, p, num, 0);
+}
+
+int
+ED25519_FN(ed25519_multi_scalarmult_vartime) (ed25519_public_key out, const unsigned char **e, const unsigned char **p, size_t num) {
+	return ed25519_multi_scalarmult_decoded(out, e, p, num, 1);
+}
+
+/*
+	Fixed base scalar multiplication for long lived points
+
+	table must be ED25519_SCALARMULT_TABLE_BYTES(positions) bytes and 16 byte
+	aligned (as malloc returns), positions is 8, 16, 32 or 64. With 32
+	positions, [e]p runs at the same speed as [e]basepoint. Both return -1
+	for any other positions
+*/
+
+int
+ED25519_FN(ed25519_scalarmult_table_build) (unsigned char *table, size_t positions, const ed25519_public_key p) {
+	bignum25519 ALIGN(16) neg;
+	ge25519 ALIGN(16) P;
+
+	if (!ge25519_niels_table_positions_valid(positions) || !ge25519_unpack_negative_vartime(&P, p))
+		return -1;
+
+	/* P was unpacked as -p */
+	curve25519_copy(neg, P.x);
+	curve25519_neg(P.x, neg);
+	curve25519_copy(neg, P.t);
+	curve25519_neg(P.t, neg);
+
+	ge25519_niels_table_build((uint8_t (*)[96])table, &P, positions);
+	return 0;
+}
+
+int
+ED25519_FN(ed25519_scalarmult_table) (ed25519_public_key out, const unsigned char e[32], const unsigned char *table, size_t positions) {
+	bignum256modm s;
+	ge25519 ALIGN(16) R;
+
+	if (!ge25519_niels_table_positions_valid(positions))
+		return -1;
+
+	expand256_modm(s, e, 32);
+	ge25519_scalarmult_niels_table(&R, (const uint8_t (*)[96])table, positions, s);
+	ge25519_pack(out, &R);
+	return 0;
+}
 
 /*
 	Fast Curve25519 basepoint scalar multiplication
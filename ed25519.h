@@ -13,11 +13,203 @@ typedef unsigned char ed25519_secret_key[32];
 
 typedef unsigned char curved25519_key[32];
 
+/* segments of a message, laid out like struct iovec */
+typedef struct ed25519_iovec_t {
+	const void *iov_base;
+	size_t iov_len;
+} ed25519_iovec;
+
 void ed25519_publickey(const ed25519_secret_key sk, ed25519_public_key pk);
 int ed25519_sign_open(const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS);
 void ed25519_sign(const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS);
 
+/* the same, over the concatenation of iovcnt segments */
+int ed25519_sign_open_iov(const ed25519_iovec *iov, size_t iovcnt, const ed25519_public_key pk, const ed25519_signature RS);
+void ed25519_sign_iov(const ed25519_iovec *iov, size_t iovcnt, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS);
+
+/* num signatures under any mix of keys, identical to ed25519_sign but sharing the field inversions */
+void ed25519_sign_batch(const unsigned char **m, size_t *mlen, const unsigned char **sk, const unsigned char **pk, unsigned char **RS, size_t num);
+
+/*
+	streaming verification, ed25519_sign_open over m fed in pieces. the context is opaque, a
+	hash function with a larger state than fits fails to compile ed25519.c
+*/
+typedef struct ed25519_sign_open_context_t {
+	unsigned long long opaque[64];
+} ed25519_sign_open_context;
+
+void ed25519_sign_open_init(ed25519_sign_open_context *ctx, const ed25519_public_key pk, const ed25519_signature RS);
+void ed25519_sign_open_update(ed25519_sign_open_context *ctx, const unsigned char *m, size_t mlen);
+int ed25519_sign_open_final(ed25519_sign_open_context *ctx);
+
+/*
+	split phase verification. prepare is the pass over m, it reduces H(R,A,m) in to a 128 byte
+	record and returns -1 for a signature that can't be valid. the curve stage verifies the
+	records later or on another thread, with ed25519_sign_open_prepared or in batches
+*/
+typedef struct ed25519_prepared_signature_t {
+	unsigned char RS[64], pk[32], h[32];
+} ed25519_prepared_signature;
+
+int ed25519_sign_open_prepare(const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, ed25519_prepared_signature *prepared);
+int ed25519_sign_open_prepare_iov(const ed25519_iovec *iov, size_t iovcnt, const ed25519_public_key pk, const ed25519_signature RS, ed25519_prepared_signature *prepared);
+int ed25519_sign_open_prepared(const ed25519_prepared_signature *prepared);
+int ed25519_sign_open_batch_prepared(const ed25519_prepared_signature *prepared, size_t num, int *valid);
+
 int ed25519_sign_open_batch(const unsigned char **m, size_t *mlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid);
+int ed25519_sign_open_batch_iov(const ed25519_iovec **iov, const size_t *iovcnt, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid);
+
+/*
+	batch verification with caller owned scratch. the calls above malloc ~70kb for each call
+	(and report every signature invalid if that fails). init places the context in at least
+	ed25519_batch_context_size() bytes of memory (NULL if len is short). a context is used by
+	one call at a time, and needs no cleanup beyond freeing the memory
+*/
+typedef struct ed25519_batch_context_t ed25519_batch_context;
+
+size_t ed25519_batch_context_size(void);
+ed25519_batch_context *ed25519_batch_context_init(void *memory, size_t len);
+int ed25519_sign_open_batch_ctx(ed25519_batch_context *ctx, const unsigned char **m, size_t *mlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid);
+int ed25519_sign_open_batch_iov_ctx(ed25519_batch_context *ctx, const ed25519_iovec **iov, const size_t *iovcnt, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid);
+int ed25519_sign_open_batch_prepared_ctx(ed25519_batch_context *ctx, const ed25519_prepared_signature *prepared, size_t num, int *valid);
+
+/*
+	incremental batch verification: signatures are added one at a time and checked as a batch
+	once threshold (at most 64, 0 for 64) are pending or on a flush. every signature's result is
+	passed to callback with its tag, from inside add (a repeat or a malformed signature, or the
+	batch it fills) or flush. add and flush return -1 if a result they passed on was invalid.
+	m, pk and RS are not needed once add returns. the callback must not use the accumulator
+*/
+typedef struct ed25519_batch_accumulator_t ed25519_batch_accumulator;
+typedef void (*ed25519_batch_callback)(void *arg, void *tag, int valid);
+
+size_t ed25519_batch_accumulator_size(void);
+ed25519_batch_accumulator *ed25519_batch_accumulator_init(void *memory, size_t len, size_t threshold, ed25519_batch_callback callback, void *arg);
+int ed25519_batch_accumulator_add(ed25519_batch_accumulator *acc, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, void *tag);
+int ed25519_batch_accumulator_flush(ed25519_batch_accumulator *acc);
+
+/* packed pks[num][32], sigs[num][64] and a message blob split by num + 1 offsets, valid is a bitset */
+int ed25519_sign_open_batch_packed(const unsigned char *m, const size_t *offsets, const unsigned char *pks, const unsigned char *sigs, size_t num, unsigned char *valid);
+
+/*
+	verifies a log of records pk[32] || sig[64] || mlen[4] (little endian) || m[mlen] in place.
+	*verified is the length of the valid prefix of whole records. returns -1 if the record at
+	*verified is invalid, 0 otherwise (*verified < loglen then means a partial last record)
+*/
+int ed25519_sign_open_log(const unsigned char *log, size_t loglen, size_t *verified);
+
+/*
+	Ed25519ph and Ed25519ctx (RFC 8032). ed25519ph_init/update/final compute the prehash
+	SHA-512(m) in one pass. contexts are at most 255 bytes, -1 is returned for longer ones
+*/
+typedef struct ed25519ph_context_t {
+	unsigned long long opaque[64];
+} ed25519ph_context;
+
+void ed25519ph_init(ed25519ph_context *ph);
+void ed25519ph_update(ed25519ph_context *ph, const unsigned char *m, size_t mlen);
+void ed25519ph_final(ed25519ph_context *ph, unsigned char prehash[64]);
+int ed25519ph_sign(const unsigned char prehash[64], const unsigned char *ctx, size_t ctxlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS);
+int ed25519ph_sign_open(const unsigned char prehash[64], const unsigned char *ctx, size_t ctxlen, const ed25519_public_key pk, const ed25519_signature RS);
+int ed25519ph_sign_open_batch(const unsigned char **prehash, const unsigned char **ctx, size_t *ctxlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid);
+
+int ed25519ctx_sign(const unsigned char *m, size_t mlen, const unsigned char *ctx, size_t ctxlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS);
+int ed25519ctx_sign_open(const unsigned char *m, size_t mlen, const unsigned char *ctx, size_t ctxlen, const ed25519_public_key pk, const ed25519_signature RS);
+int ed25519ctx_sign_open_batch(const unsigned char **m, size_t *mlen, const unsigned char **ctx, size_t *ctxlen, const unsigned char **pk, const unsigned char **RS, size_t num, int *valid);
+
+int ed25519_scalarmult(ed25519_public_key out, const unsigned char e[32], const ed25519_public_key p);
+int ed25519_multi_scalarmult(ed25519_public_key out, const unsigned char **e, const unsigned char **p, size_t num);
+int ed25519_multi_scalarmult_vartime(ed25519_public_key out, const unsigned char **e, const unsigned char **p, size_t num);
+
+#define ED25519_SCALARMULT_TABLE_BYTES(positions) ((positions) * 8 * 96)
+
+int ed25519_scalarmult_table_build(unsigned char *table, size_t positions, const ed25519_public_key p);
+int ed25519_scalarmult_table(ed25519_public_key out, const unsigned char e[32], const unsigned char *table, size_t positions);
+
+/*
+	only available when built with ED25519_VERIFY_SERVICE: worker threads batch verifying signatures
+	submitted one at a time. capacity is rounded up to a power of 2, and a partial batch waits up
+	to max_latency_us for more signatures. submit returns -1 when the queue is full, otherwise
+	callback(arg, tag, valid) runs on a worker once the signature is verified, and m, pk and RS
+	must stay valid until then. destroy finishes the submitted signatures first
+*/
+typedef struct ed25519_verify_service_t ed25519_verify_service;
+
+ed25519_verify_service *ed25519_verify_service_create(size_t threads, size_t capacity, unsigned long max_latency_us);
+void ed25519_verify_service_destroy(ed25519_verify_service *svc);
+int ed25519_verify_service_submit(ed25519_verify_service *svc, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag);
+int ed25519_verify_service_sign_open(ed25519_verify_service *svc, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS);
+
+/*
+	priority classes for the services. interactive requests are taken first, up to 8 at a time
+	without waiting for more, and workers come back for them after every 32 signatures of a bulk
+	batch. submit and sign_open are bulk
+*/
+#define ED25519_PRIORITY_INTERACTIVE 0
+#define ED25519_PRIORITY_BULK 1
+
+/* wait_us_log2[0] counts waits under 1us, [i] waits of 2^(i-1) to 2^i - 1us, the last also anything longer */
+typedef struct ed25519_service_stats_t {
+	size_t depth;
+	unsigned long long completed, wait_us_total, wait_us_max;
+	unsigned long long wait_us_log2[24];
+} ed25519_service_stats;
+
+int ed25519_verify_service_submit_priority(ed25519_verify_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag);
+int ed25519_verify_service_sign_open_priority(ed25519_verify_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS);
+
+/* a snapshot of one class: requests queued now, and how long those started so far waited for a worker */
+void ed25519_verify_service_stats(ed25519_verify_service *svc, int priority, ed25519_service_stats *stats);
+
+/*
+	only available when built with ED25519_SIGN_SERVICE: the same for signing, requests under any
+	mix of keys are signed together with ed25519_sign_batch. callback(arg, tag, 1) runs on a worker
+	once RS is written, and m, sk and pk must stay valid until then. sign blocks for the signature.
+	the priority classes and stats are the verify service's
+*/
+typedef struct ed25519_sign_service_t ed25519_sign_service;
+
+ed25519_sign_service *ed25519_sign_service_create(size_t threads, size_t capacity, unsigned long max_latency_us);
+void ed25519_sign_service_destroy(ed25519_sign_service *svc);
+int ed25519_sign_service_submit(ed25519_sign_service *svc, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag);
+void ed25519_sign_service_sign(ed25519_sign_service *svc, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS);
+int ed25519_sign_service_submit_priority(ed25519_sign_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS, ed25519_batch_callback callback, void *arg, void *tag);
+void ed25519_sign_service_sign_priority(ed25519_sign_service *svc, int priority, const unsigned char *m, size_t mlen, const ed25519_secret_key sk, const ed25519_public_key pk, ed25519_signature RS);
+void ed25519_sign_service_stats(ed25519_sign_service *svc, int priority, ed25519_service_stats *stats);
+
+/*
+	only available when built with ED25519_SPLIT_VERIFY: checks one signature on the calling thread
+	and a helper thread started with the verifier, for when the latency of a single check matters.
+	the verifier keeps tables for recently seen keys and is used by one thread at a time
+*/
+typedef struct ed25519_split_verifier_t ed25519_split_verifier;
+
+ed25519_split_verifier *ed25519_split_verifier_create(void);
+void ed25519_split_verifier_destroy(ed25519_split_verifier *v);
+int ed25519_split_verifier_sign_open(ed25519_split_verifier *v, const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS);
+
+/*
+	only available when built with ED25519_NONCE_POOL: nonces for one key precomputed by fill,
+	which returns how many were added before the pool filled up. sign_pooled takes one per
+	signature, or derives one online when the pool is empty. nonces are random rather than
+	derived from m, so the signatures verify normally but differ from ed25519_sign. a pool used
+	after fork() drops the nonces it inherited and reseeds in each process
+*/
+typedef struct ed25519_nonce_pool_t ed25519_nonce_pool;
+
+ed25519_nonce_pool *ed25519_nonce_pool_create(const ed25519_secret_key sk, const ed25519_public_key pk, size_t capacity);
+void ed25519_nonce_pool_destroy(ed25519_nonce_pool *pool);
+size_t ed25519_nonce_pool_fill(ed25519_nonce_pool *pool, size_t count);
+size_t ed25519_nonce_pool_available(ed25519_nonce_pool *pool);
+void ed25519_sign_pooled(ed25519_nonce_pool *pool, const unsigned char *m, size_t mlen, ed25519_signature RS);
+
+/* only available when built with ED25519_KEY_CACHE */
+void ed25519_key_cache_stats(size_t *hits, size_t *misses);
+void ed25519_key_cache_clear(void);
+
+/* only available when built with ED25519_VERIFY_CACHE */
+void ed25519_verify_cache_stats(size_t *hits, size_t *misses);
+void ed25519_verify_cache_clear(void);
 
 void ed25519_randombytes_unsafe(void *out, size_t count);
 
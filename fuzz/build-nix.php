@@ -9,7 +9,7 @@
 		echoln("Flags in parantheses are optional");
 		echoln("");
 		echoln("  --bits=[32,64]");
-		echoln("  --function=[curve25519,ed25519]");
+		echoln("  --function=[curve25519,ed25519,boscoster]");
 		echoln(" (--compiler=[*gcc,clang,icc])        which compiler to use, gcc is default");
 		echoln(" (--with-openssl)                     use openssl for SHA512");
 		echoln(" (--with-sse2)                        additionally fuzz against SSE2");
@@ -81,7 +81,7 @@
 	}
 
 	$bits = new multiargument("bits", array("32", "64"));
-	$function = new multiargument("function", array("curve25519", "ed25519"));
+	$function = new multiargument("function", array("curve25519", "ed25519", "boscoster"));
 	$compiler = new multiargument("compiler", array("gcc", "clang", "icc"));
 	$with_sse2 = new flag("with-sse2");
 	$with_openssl = new flag("with-openssl");
@@ -127,6 +127,11 @@
 		}
 		runcmd("linking..", "{$compile} {$flags} {$link} fuzz-ed25519.c ed25519.o ed25519-ref10.o -o fuzz-ed25519");
 		echoln("fuzz-ed25519 built.");
+	} else if ($function->value === "boscoster") {
+		if ($with_sse2->set)
+			$flags .= " -DED25519_SSE2 -msse2";
+		runcmd("building fuzz-boscoster..", "{$compile} {$flags} fuzz-boscoster.c -o fuzz-boscoster");
+		echoln("fuzz-boscoster built.");
 	}
 
 
@@ -0,0 +1,246 @@
+#if defined(_WIN32)
+	#include <windows.h>
+	#include <wincrypt.h>
+	typedef unsigned int uint32_t;
+	typedef unsigned __int64 uint64_t;
+#else
+	#include <stdint.h>
+#endif
+
+#include <string.h>
+#include <stdio.h>
+
+/* the internals, not the fuzz/ wrapper header */
+#include "../ed25519-donna.h"
+
+static void
+print_bytes(const char *desc, const unsigned char *bytes, size_t len) {
+	size_t p = 0;
+	printf("%s:\n", desc);
+	while (len--) {
+		printf("0x%02x,", *bytes++);
+		if ((++p & 15) == 0)
+			printf("\n");
+	}
+	printf("\n");
+}
+
+
+/* chacha20/12 prng */
+void
+prng(unsigned char *out, size_t bytes) {
+	static uint32_t state[16];
+	static int init = 0;
+	uint32_t x[16], t;
+	size_t i;
+
+	if (!init) {
+	#if defined(_WIN32)
+		HCRYPTPROV csp = NULL;
+		if (!CryptAcquireContext(&csp, 0, 0, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
+			printf("CryptAcquireContext failed\n");
+			exit(1);
+		}
+		if (!CryptGenRandom(csp, (DWORD)sizeof(state), (BYTE*)state)) {
+			printf("CryptGenRandom failed\n");
+			exit(1);
+		}
+		CryptReleaseContext(csp, 0);
+	#else
+		FILE *f = NULL;
+		f = fopen("/dev/urandom", "rb");
+		if (!f) {
+			printf("failed to open /dev/urandom\n");
+			exit(1);
+		}
+		if (fread(state, sizeof(state), 1, f) != 1) {
+			printf("read error on /dev/urandom\n");
+			exit(1);
+		}
+	#endif
+		init = 1;
+	}
+
+	while (bytes) {
+		for (i = 0; i < 16; i++) x[i] = state[i];
+
+		#define rotl32(x,k) ((x << k) | (x >> (32 - k)))
+		#define quarter(a,b,c,d) \
+			x[a] += x[b]; t = x[d]^x[a]; x[d] = rotl32(t,16); \
+			x[c] += x[d]; t = x[b]^x[c]; x[b] = rotl32(t,12); \
+			x[a] += x[b]; t = x[d]^x[a]; x[d] = rotl32(t, 8); \
+			x[c] += x[d]; t = x[b]^x[c]; x[b] = rotl32(t, 7);
+
+		for (i = 0; i < 12; i += 2) {
+			quarter( 0, 4, 8,12)
+			quarter( 1, 5, 9,13)
+			quarter( 2, 6,10,14)
+			quarter( 3, 7,11,15)
+			quarter( 0, 5,10,15)
+			quarter( 1, 6,11,12)
+			quarter( 2, 7, 8,13)
+			quarter( 3, 4, 9,14)
+		};
+
+		if (bytes <= 64) {
+			memcpy(out, x, bytes);
+			bytes = 0;
+		} else {
+			memcpy(out, x, 64);
+			bytes -= 64;
+			out += 64;
+		}
+
+		/* don't need a nonce, so last 4 words are the counter. 2^136 bytes can be generated */
+		if (!++state[12]) if (!++state[13]) if (!++state[14]) ++state[15];
+	}
+}
+
+static size_t
+prng_range(size_t range) {
+	uint32_t v;
+	prng((unsigned char *)&v, sizeof(v));
+	return (size_t)(v % range);
+}
+
+/*
+	searches for scalars that make bos-coster slow. the points do not affect the
+	iteration count, so only the scalars are mutated, and a candidate is kept when
+	it needs more iterations. every run is checked against the bounded evaluation
+*/
+
+typedef struct candidate_t {
+	size_t count, initial;
+	unsigned char s[heap_batch_size][32];
+} candidate;
+
+static void
+mutate(candidate *c) {
+	size_t i = prng_range(c->count), j = prng_range(c->count), k, shift;
+	unsigned char delta;
+
+	switch (prng_range(6)) {
+		case 0: /* new random scalar */
+			prng(c->s[i], 32);
+			break;
+		case 1: /* close to another scalar */
+			memcpy(c->s[i], c->s[j], 32);
+			prng(&delta, 1);
+			c->s[i][0] ^= delta;
+			break;
+		case 2: /* tiny */
+			memset(c->s[i], 0, 32);
+			prng(c->s[i], 1);
+			break;
+		case 3: /* zero */
+			memset(c->s[i], 0, 32);
+			break;
+		case 4: /* flip a bit */
+			k = prng_range(256);
+			c->s[i][k / 8] ^= (unsigned char)(1 << (k % 8));
+			break;
+		case 5: /* another scalar shifted down */
+			shift = 1 + prng_range(255);
+			memset(c->s[i], 0, 32);
+			for (k = shift; k < 256; k++)
+				if (c->s[j][k / 8] & (1 << (k % 8)))
+					c->s[i][(k - shift) / 8] |= (unsigned char)(1 << ((k - shift) % 8));
+			break;
+	}
+}
+
+static void
+random_candidate(candidate *c) {
+	/* odd sizes only, with either full scalars or the batch verification shape */
+	c->count = (2 * (1 + prng_range(heap_batch_size / 2))) + 1;
+	c->initial = prng_range(2) ? c->count : (((c->count / 2) + 1) | 1);
+	prng((unsigned char *)c->s, sizeof(c->s));
+}
+
+/* returns the iteration count, exits on a wrong result */
+static size_t
+run(const candidate *c, const ge25519 *points) {
+	static batch_heap ALIGN(16) heap;
+	static ge25519_msm_scratch ALIGN(16) scratch;
+	bignum256modm scalars[heap_batch_size];
+	unsigned char want[32], got[32];
+	ge25519 ALIGN(16) r;
+	size_t i, iterations;
+
+	for (i = 0; i < c->count; i++) {
+		expand256_modm(scalars[i], c->s[i], (i < c->initial) ? 32 : 16);
+		memcpy(heap.scalars[i], scalars[i], sizeof(bignum256modm));
+		heap.points[i] = points[i];
+	}
+
+	iterations = ge25519_multi_scalarmult_boscoster_vartime(&r, &heap, c->initial, c->count);
+	ge25519_pack(got, &r);
+	ge25519_multi_scalarmult_bounded_vartime(&r, points, (const bignum256modm *)scalars, c->count, &scratch);
+	ge25519_pack(want, &r);
+
+	if (memcmp(want, got, 32) != 0) {
+		printf("\n\nbos-coster and bounded evaluation disagree, %u points, %u initial\n\n", (unsigned)c->count, (unsigned)c->initial);
+		for (i = 0; i < c->count; i++)
+			print_bytes("s", c->s[i], (i < c->initial) ? 32 : 16);
+		exit(1);
+	}
+	return iterations;
+}
+
+int main() {
+	static ge25519 ALIGN(16) points[heap_batch_size];
+	static candidate best, next;
+	bignum256modm s;
+	unsigned char sk[32];
+	size_t i, iterations, best_iterations = 0, stale = 0;
+	double ratio, worst = 0;
+	uint64_t ctr;
+
+	printf("fuzzing: bos-coster iteration budget\n\n");
+
+	for (i = 0; i < heap_batch_size; i++) {
+		prng(sk, 32);
+		expand256_modm(s, sk, 32);
+		ge25519_scalarmult_base_niels(&points[i], ge25519_niels_base_multiples, s);
+	}
+
+	for (ctr = 0;; ctr++) {
+		/* restart from a random candidate when the search stops making progress */
+		if (!best_iterations || (stale > 0x400)) {
+			random_candidate(&best);
+			best_iterations = run(&best, points);
+			stale = 0;
+		}
+
+		next = best;
+		for (i = 1 + prng_range(4); i; i--)
+			mutate(&next);
+		iterations = run(&next, points);
+		if (iterations > best_iterations) {
+			best = next;
+			best_iterations = iterations;
+			stale = 0;
+		} else {
+			stale++;
+		}
+
+		ratio = (double)iterations / ge25519_boscoster_budget(next.count);
+		if (ratio > worst) {
+			worst = ratio;
+			printf("\nworst: %u points (%u initial), %u iterations, %.2f of the budget%s\n", (unsigned)next.count, (unsigned)next.initial,
+				(unsigned)iterations, ratio, (ratio >= 1) ? ", fell back" : "");
+		}
+
+		/* print out status */
+		if (ctr && (ctr % 0x100 == 0)) {
+			printf(".");
+			if ((ctr % 0x2000) == 0) {
+				printf(" [");
+				for (i = 0; i < 8; i++)
+					printf("%02x", (unsigned char)(ctr >> ((7 - i) * 8)));
+				printf("]\n");
+			}
+			fflush(stdout);
+		}
+	}
+}
@@ -0,0 +1,149 @@
+/*
+	Checks ed25519-coroutine.hpp against ed25519_sign_open
+
+		gcc -O2 -c ed25519.c -DED25519_REFHASH -DED25519_TEST -o ed25519.o
+		g++ -std=c++20 -O2 test-coroutine.cpp ed25519.o -o test-coroutine
+*/
+
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "ed25519-coroutine.hpp"
+
+static void
+edassert(int check, int round, const char *failreason) {
+	if (check)
+		return;
+	printf("round %d, %s\n", round, failreason);
+	exit(1);
+}
+
+/* test data */
+typedef struct test_data_t {
+	unsigned char sk[32], pk[32], sig[64];
+	const char *m;
+} test_data;
+
+test_data dataset[] = {
+#include "regression.h"
+};
+
+/* runs to its first await straight away, the frame is freed when it returns */
+struct task {
+	struct promise_type {
+		task get_return_object() noexcept { return task(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::abort(); }
+	};
+};
+
+#define test_awaiters 100
+#define test_threshold 16
+#define test_forged 37
+
+static ed25519_signature sigs[test_awaiters];
+static int results[test_awaiters][2];
+static size_t finished;
+
+static task
+check(size_t i) {
+	bool valid = co_await ed25519::verify(dataset[i].pk, sigs[i], (const unsigned char *)dataset[i].m, i);
+	results[i][0] = valid;
+	finished++;
+}
+
+/* awaits again from inside the resume of its first batch, the second time on a forgery */
+static task
+check_twice(ed25519::batch_executor &executor, size_t i) {
+	bool valid = co_await ed25519::verify(executor, dataset[i].pk, dataset[i].sig, (const unsigned char *)dataset[i].m, i);
+	results[i][0] = valid;
+	valid = co_await ed25519::verify(executor, dataset[i].pk, sigs[test_forged], (const unsigned char *)dataset[i].m, i);
+	results[i][1] = valid;
+	finished++;
+}
+
+static void
+reset(void) {
+	size_t i;
+
+	for (i = 0; i < test_awaiters; i++) {
+		memcpy(sigs[i], dataset[i].sig, 64);
+		results[i][0] = results[i][1] = -1;
+	}
+	sigs[test_forged][5] ^= 1;
+	finished = 0;
+}
+
+/* 100 awaiters against a threshold of 16, the last partial batch is flushed */
+static void
+test_batches(void) {
+	ed25519::batch_executor executor(test_threshold, std::chrono::hours(1));
+	size_t i;
+
+	reset();
+	edassert(ed25519::batch_executor::current() == &executor, 0, "executor isn't current");
+	for (i = 0; i < test_awaiters; i++)
+		check(i);
+	edassert(finished == (test_awaiters / test_threshold) * test_threshold, 0, "full batches weren't run");
+	edassert(executor.pending() == (test_awaiters % test_threshold), 0, "wrong number of awaiters pending");
+	edassert(executor.poll() == 0, 0, "poll flushed before the deadline");
+	edassert(executor.flush() == (test_awaiters % test_threshold), 0, "flush didn't resume the pending awaiters");
+	for (i = 0; i < test_awaiters; i++) {
+		edassert(results[i][0] == ((ed25519_sign_open((const unsigned char *)dataset[i].m, i, dataset[i].pk, sigs[i]) == 0) ? 1 : 0), (int)i, "coroutine disagreed with ed25519_sign_open");
+		edassert(results[i][0] == (i != test_forged), (int)i, "coroutine gave the wrong result");
+	}
+}
+
+static void
+test_reawait(void) {
+	ed25519::batch_executor executor(test_threshold, std::chrono::hours(1));
+	size_t i;
+
+	reset();
+	for (i = 0; i < 20; i++)
+		check_twice(executor, i);
+	while (executor.pending())
+		executor.flush();
+	edassert(finished == 20, 0, "re-awaiting coroutines didn't finish");
+	for (i = 0; i < 20; i++)
+		edassert((results[i][0] == 1) && (results[i][1] == 0), (int)i, "re-awaiting coroutine gave the wrong result");
+}
+
+/* with no executor alive verify() checks on the spot */
+static void
+test_no_executor(void) {
+	reset();
+	edassert(ed25519::batch_executor::current() == nullptr, 0, "executor outlived its scope");
+	check(1);
+	check(test_forged);
+	edassert((finished == 2) && (results[1][0] == 1) && (results[test_forged][0] == 0), 0, "verify without an executor gave the wrong result");
+}
+
+/* executors destroyed out of order leave the newest one still alive current */
+static void
+test_destroy_order(void) {
+	ed25519::batch_executor *a = new ed25519::batch_executor(), *b = new ed25519::batch_executor(), *c = new ed25519::batch_executor();
+
+	delete b;
+	edassert(ed25519::batch_executor::current() == c, 0, "destroying an older executor changed current");
+	delete c;
+	edassert(ed25519::batch_executor::current() == a, 0, "destroying the newest executor didn't restore the one before it");
+	b = new ed25519::batch_executor();
+	delete a;
+	edassert(ed25519::batch_executor::current() == b, 0, "destroying the oldest executor changed current");
+	delete b;
+	edassert(ed25519::batch_executor::current() == nullptr, 0, "an executor is current after all were destroyed");
+}
+
+int
+main(void) {
+	test_batches();
+	test_reawait();
+	test_no_executor();
+	test_destroy_order();
+	return 0;
+}
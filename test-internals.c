@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "ed25519-donna.h"
+#include "test-ticks.h"
 
 static int
 test_adds() {
@@ -158,6 +159,257 @@ test_subs() {
 	return 0;
 }
 
+static int
+test_scalarmult() {
+	/* 0, 1, 8, -8 mod 16 in every window, l - 1, 2^256 - 1 */
+	static const unsigned char scalars[6][32] = {
+		{0x00},
+		{0x01},
+		{0x08},
+		{0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,
+		 0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x88,0x08},
+		{0xec,0xd3,0xf5,0x5c,0x1a,0x63,0x12,0x58,0xd6,0x9c,0xf7,0xa2,0xde,0xf9,0xde,0x14,
+		 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10},
+		{0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		 0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff}
+	};
+	unsigned char want[32], got[32];
+	bignum256modm s, zero = {0};
+	ge25519 ALIGN(16) p, r;
+	size_t i, j;
+
+	/* compare against the variable time double scalarmult for [s]B and [s]([s']B) */
+	p = ge25519_basepoint;
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 6; j++) {
+			expand256_modm(s, scalars[j], 32);
+			ge25519_scalarmult(&r, &p, s);
+			ge25519_pack(got, &r);
+			ge25519_double_scalarmult_vartime(&r, &p, s, zero);
+			ge25519_pack(want, &r);
+			if (memcmp(want, got, 32) != 0)
+				return -1;
+		}
+		expand256_modm(s, scalars[3], 32);
+		ge25519_scalarmult_base_niels(&p, ge25519_niels_base_multiples, s);
+	}
+
+	return 0;
+}
+
+static int
+test_niels_table() {
+	static uint8_t ALIGN(16) table[64 * 8][96];
+	static const unsigned char scalar[32] = {
+		0xd4,0x1c,0x71,0x33,0x80,0x06,0x5e,0x9f,0xa7,0x3b,0x41,0xe5,0x20,0xcc,0x17,0x88,
+		0x0a,0xf2,0x6b,0x95,0x3e,0x58,0xb1,0x07,0xc9,0x64,0x2d,0xfb,0x12,0x8e,0x4f,0x0c
+	};
+	unsigned char want[32], got[32];
+	bignum256modm s, sp;
+	ge25519 ALIGN(16) p, r;
+	size_t positions;
+
+	/* the basepoint table built at runtime matches the precomputed one */
+	ge25519_niels_table_build(table, &ge25519_basepoint, 32);
+	if (memcmp(table, ge25519_niels_base_multiples, sizeof(ge25519_niels_base_multiples)) != 0)
+		return -1;
+
+	/* every table size agrees with the variable base scalarmult on p = [scalar]B */
+	expand256_modm(sp, scalar, 32);
+	expand256_modm(s, scalar + 1, 31);
+	ge25519_scalarmult_base_niels(&p, ge25519_niels_base_multiples, sp);
+	ge25519_scalarmult(&r, &p, s);
+	ge25519_pack(want, &r);
+	for (positions = 8; positions <= 64; positions *= 2) {
+		ge25519_niels_table_build(table, &p, positions);
+		ge25519_scalarmult_niels_table(&r, table, positions, s);
+		ge25519_pack(got, &r);
+		if (memcmp(want, got, 32) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+test_multi_scalarmult() {
+	/* covers straus (incl. chunking), bos-coster (odd/even), and pippenger */
+	static const size_t counts[] = {1, 2, 17, 48, 64, 129, 150};
+	static ge25519 ALIGN(16) points[150];
+	static bignum256modm scalars[150];
+	static ge25519_msm_scratch scratch;
+	static batch_heap ALIGN(64) heap;
+	unsigned char buf[64], want[32], got[32];
+	ge25519 ALIGN(16) r, sum;
+	uint32_t x = 0x9e3779b9;
+	size_t i, j, c, count;
+
+	for (i = 0; i < 150; i++) {
+		for (j = 0; j < 64; j++) {
+			x = (x * 1664525) + 1013904223;
+			buf[j] = (unsigned char)(x >> 24);
+		}
+		expand256_modm(scalars[i], buf, 32);
+		ge25519_scalarmult_base_niels(&points[i], ge25519_niels_base_multiples, scalars[i]);
+		/* every 5th scalar is 0, every 7th is only 128 bits */
+		expand256_modm(scalars[i], buf + 32, (i % 5) ? ((i % 7) ? 32 : 16) : 0);
+	}
+
+	heap.scratch = &scratch;
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		count = counts[c];
+
+		memset(&sum, 0, sizeof(ge25519));
+		sum.y[0] = 1;
+		sum.z[0] = 1;
+		for (i = 0; i < count; i++) {
+			ge25519_scalarmult(&r, &points[i], scalars[i]);
+			ge25519_add(&sum, &sum, &r);
+		}
+		ge25519_pack(want, &sum);
+
+		ge25519_multi_scalarmult_vartime(&r, points, scalars, count, &heap);
+		ge25519_pack(got, &r);
+		if (memcmp(want, got, 32) != 0)
+			return -1;
+
+		ge25519_multi_scalarmult_straus_vartime(&r, points, scalars, count, &scratch);
+		ge25519_pack(got, &r);
+		if (memcmp(want, got, 32) != 0)
+			return -1;
+
+		ge25519_multi_scalarmult_pippenger_vartime(&r, points, scalars, count, 253, &scratch);
+		ge25519_pack(got, &r);
+		if (memcmp(want, got, 32) != 0)
+			return -1;
+
+		ge25519_multi_scalarmult(&r, points, scalars, count);
+		ge25519_pack(got, &r);
+		if (memcmp(want, got, 32) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+test_boscoster_budget() {
+	static batch_heap ALIGN(16) heap;
+	static ge25519_msm_scratch scratch;
+	static ge25519 ALIGN(16) points[65];
+	static bignum256modm scalars[65];
+	unsigned char buf[32], want[32], got[32];
+	ge25519 ALIGN(16) r, sum;
+	uint32_t x = 0x85ebca6b;
+	size_t i, j, crafted, iterations;
+
+	/* crafted 1 falls back with tables it allocates, crafted 2 with the caller's */
+	for (crafted = 0; crafted < 3; crafted++) {
+		heap.scratch = (crafted == 2) ? &scratch : NULL;
+		for (i = 0; i < 65; i++) {
+			for (j = 0; j < 32; j++) {
+				x = (x * 1664525) + 1013904223;
+				buf[j] = (unsigned char)(x >> 24);
+			}
+			expand256_modm(scalars[i], buf, 32);
+			ge25519_scalarmult_base_niels(&points[i], ge25519_niels_base_multiples, scalars[i]);
+			expand256_modm(scalars[i], buf, (crafted && (i > 1)) ? 1 : 32);
+		}
+		/* one huge scalar and one of 1, bos-coster would need ~2^252 iterations */
+		if (crafted) {
+			memset(buf, 0xff, 32);
+			expand256_modm(scalars[0], buf, 32);
+			memset(scalars[1], 0, sizeof(bignum256modm));
+			scalars[1][0] = 1;
+		}
+
+		memset(&sum, 0, sizeof(ge25519));
+		sum.y[0] = 1;
+		sum.z[0] = 1;
+		for (i = 0; i < 65; i++) {
+			ge25519_scalarmult(&r, &points[i], scalars[i]);
+			ge25519_add(&sum, &sum, &r);
+			heap.points[i] = points[i];
+			memcpy(heap.scalars[i], scalars[i], sizeof(bignum256modm));
+		}
+		ge25519_pack(want, &sum);
+
+		iterations = ge25519_multi_scalarmult_boscoster_vartime(&r, &heap, 65, 65);
+		ge25519_pack(got, &r);
+		if (memcmp(want, got, 32) != 0)
+			return -1;
+
+		/* random scalars finish well within the budget, crafted ones fall back */
+		if ((iterations == ge25519_boscoster_budget(65)) != (crafted != 0))
+			return -1;
+	}
+
+	/* counts with no log2 get the budget of 2, and no count gets an empty one */
+	if ((ge25519_boscoster_budget(0) != ge25519_boscoster_budget(2)) || (ge25519_boscoster_budget(1) != ge25519_boscoster_budget(2)))
+		return -1;
+	for (i = 2; i < 130; i++)
+		if (!ge25519_boscoster_budget(i))
+			return -1;
+
+	/* a single scalar > 1 left over goes through the final double and add */
+	memset(heap.scalars, 0, 3 * sizeof(bignum256modm));
+	heap.scalars[0][0] = 5;
+	heap.points[0] = points[0];
+	heap.points[1] = points[1];
+	heap.points[2] = points[2];
+	ge25519_multi_scalarmult_boscoster_vartime(&r, &heap, 3, 3);
+	ge25519_pack(got, &r);
+	memset(scalars[0], 0, sizeof(bignum256modm));
+	scalars[0][0] = 5;
+	ge25519_scalarmult(&r, &points[0], scalars[0]);
+	ge25519_pack(want, &r);
+	if (memcmp(want, got, 32) != 0)
+		return -1;
+
+	return 0;
+}
+
+/* bos-coster alone, for the batch verification shape and for full width scalars */
+static void
+bench_boscoster() {
+	static const size_t counts[] = {33, 65, 129};
+	static batch_heap ALIGN(16) heap, work;
+	unsigned char buf[32];
+	uint64_t ticks, t;
+	ge25519 ALIGN(16) r;
+	uint32_t x = 0x7f4a7c15;
+	size_t i, j, c, count, narrow;
+
+	for (i = 0; i < heap_batch_size; i++) {
+		for (j = 0; j < 32; j++) {
+			x = (x * 1664525) + 1013904223;
+			buf[j] = (unsigned char)(x >> 24);
+		}
+		expand256_modm(heap.scalars[i], buf, 32);
+		ge25519_scalarmult_base_niels(&heap.points[i], ge25519_niels_base_multiples, heap.scalars[i]);
+	}
+
+	for (narrow = 0; narrow < 2; narrow++) {
+		for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+			count = counts[c];
+			/* batch verification: (count / 2) + 1 full scalars, the rest 128 bits */
+			for (i = 0; i < count; i++) {
+				for (j = 0; j < 32; j++) {
+					x = (x * 1664525) + 1013904223;
+					buf[j] = (unsigned char)(x >> 24);
+				}
+				expand256_modm(heap.scalars[i], buf, (narrow && (i > (count / 2))) ? 16 : 32);
+			}
+
+			t = maxticks;
+			for (i = 0; i < 16; i++) {
+				memcpy(&work, &heap, sizeof(batch_heap));
+				timeit(ge25519_multi_scalarmult_boscoster_vartime(&r, &work, narrow ? ((count / 2) + 1) : count, count), t)
+			}
+			printf("%.0f ticks/point in a %u point bos-coster (%s)\n", (double)t / count, (unsigned)count, narrow ? "batch verify scalars" : "full scalars");
+		}
+	}
+}
 
 int
 main() {
@@ -169,7 +421,22 @@ main() {
 	single = test_subs();
 	if (single) printf("test_subs: FAILED\n");
 	ret |= single;
-	if (!ret) printf("success\n");
+	single = test_scalarmult();
+	if (single) printf("test_scalarmult: FAILED\n");
+	ret |= single;
+	single = test_niels_table();
+	if (single) printf("test_niels_table: FAILED\n");
+	ret |= single;
+	single = test_multi_scalarmult();
+	if (single) printf("test_multi_scalarmult: FAILED\n");
+	ret |= single;
+	single = test_boscoster_budget();
+	if (single) printf("test_boscoster_budget: FAILED\n");
+	ret |= single;
+	if (!ret) {
+		bench_boscoster();
+		printf("success\n");
+	}
 	return ret;
 }
 
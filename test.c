@@ -6,6 +6,13 @@
 #include <stdio.h>
 #include <string.h>
 #include "ed25519.h"
+#if defined(ED25519_VERIFY_SERVICE)
+#include <pthread.h>
+#endif
+#if defined(ED25519_NONCE_POOL) && !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include "test-ticks.h"
 
@@ -65,10 +72,28 @@ const curved25519_key curved25519_expected = {
 };
 
 
-/* from ed25519-donna-batchverify.h */
+/* from ed25519.c */
 extern unsigned char batch_point_buffer[3][32];
 
-/* y coordinate of the final point from 'amd64-51-30k' with the same random generator */
+/* y coordinate of the final point with the same random generator */
+#if defined(ED25519_COFACTORED)
+/* multiplied by 8 before the check */
+static const unsigned char batch_verify_y[32] = {
+	0xf3,0x47,0x66,0x65,0x8e,0x95,0x4c,0x80,
+	0xea,0xbf,0xca,0x5a,0xda,0x1a,0x5c,0xbf,
+	0x0f,0x92,0x09,0x5d,0x21,0xba,0xcf,0x39,
+	0x5a,0x4e,0x66,0xb5,0xd9,0x77,0xcb,0x11
+};
+#else
+static const unsigned char batch_verify_y[32] = {
+	0xf1,0x62,0x34,0x5b,0x88,0x90,0x13,0x36,
+	0x2a,0x46,0xe2,0x47,0x58,0x1c,0xca,0x09,
+	0xac,0x46,0x05,0x6a,0x3d,0xce,0x53,0x05,
+	0x87,0xb2,0x13,0xb1,0xee,0x67,0x51,0x44
+};
+#endif
+
+/*
 static const unsigned char batch_verify_y[32] = {
 	0x51,0xe7,0x68,0xe0,0xf7,0xa1,0x88,0x45,
 	0xde,0xa1,0xcb,0xd9,0x37,0xd4,0x78,0x53,
@@ -76,7 +101,10 @@ static const unsigned char batch_verify_y[32] = {
 	0x94,0x51,0x2f,0xbc,0x0d,0x66,0xba,0x3f
 };
 
-/*
+This is the y from 'amd64-51-30k', which uses a binary heap. The 4-ary heap
+picks a different max2 when two scalars tie, which adds the points in a
+different order and produces a different, yet still neutral/valid y/z value.
+
 static const unsigned char batch_verify_y[32] = {
 	0x5c,0x63,0x96,0x26,0xca,0xfe,0xfd,0xc4,
 	0x2d,0x11,0xa8,0xe4,0xc4,0x46,0x42,0x97,
@@ -104,6 +132,87 @@ ed25519-donna-batchverify.h has been modified to match the
 default amd64-64-24k / amd64-51-32k behaviour
 */
 
+/* RFC 8032 7.3, Ed25519ph of "abc" */
+static const unsigned char rfc8032_ph_sk[32] = {
+	0x83,0x3f,0xe6,0x24,0x09,0x23,0x7b,0x9d,
+	0x62,0xec,0x77,0x58,0x75,0x20,0x91,0x1e,
+	0x9a,0x75,0x9c,0xec,0x1d,0x19,0x75,0x5b,
+	0x7d,0xa9,0x01,0xb9,0x6d,0xca,0x3d,0x42
+};
+
+static const unsigned char rfc8032_ph_pk[32] = {
+	0xec,0x17,0x2b,0x93,0xad,0x5e,0x56,0x3b,
+	0xf4,0x93,0x2c,0x70,0xe1,0x24,0x50,0x34,
+	0xc3,0x54,0x67,0xef,0x2e,0xfd,0x4d,0x64,
+	0xeb,0xf8,0x19,0x68,0x34,0x67,0xe2,0xbf
+};
+
+static const unsigned char rfc8032_ph_sig[64] = {
+	0x98,0xa7,0x02,0x22,0xf0,0xb8,0x12,0x1a,
+	0xa9,0xd3,0x0f,0x81,0x3d,0x68,0x3f,0x80,
+	0x9e,0x46,0x2b,0x46,0x9c,0x7f,0xf8,0x76,
+	0x39,0x49,0x9b,0xb9,0x4e,0x6d,0xae,0x41,
+	0x31,0xf8,0x50,0x42,0x46,0x3c,0x2a,0x35,
+	0x5a,0x20,0x03,0xd0,0x62,0xad,0xf5,0xaa,
+	0xa1,0x0b,0x8c,0x61,0xe6,0x36,0x06,0x2a,
+	0xaa,0xd1,0x1c,0x2a,0x26,0x08,0x34,0x06
+};
+
+/* the same under the context "foo" */
+static const unsigned char rfc8032_ph_foo_sig[64] = {
+	0xe0,0x39,0x70,0x2b,0x4c,0x25,0x95,0xa6,
+	0xa5,0x41,0xac,0x85,0x09,0x23,0x6e,0x29,
+	0x90,0x47,0x47,0x95,0x33,0x0c,0x9b,0x34,
+	0xa7,0x5f,0x58,0xa6,0x60,0x12,0x9e,0x08,
+	0xfd,0x73,0x69,0x43,0xfb,0x19,0x43,0xa5,
+	0x57,0x20,0xb9,0xe0,0x95,0x7b,0x1e,0xd6,
+	0x73,0x48,0x16,0x61,0x9f,0x13,0x88,0xf4,
+	0x3f,0x73,0xe6,0xe3,0xba,0xa8,0x1c,0x0e
+};
+
+/* RFC 8032 7.2, Ed25519ctx under the context "foo" */
+static const unsigned char rfc8032_ctx_sk[32] = {
+	0x03,0x05,0x33,0x4e,0x38,0x1a,0xf7,0x8f,
+	0x14,0x1c,0xb6,0x66,0xf6,0x19,0x9f,0x57,
+	0xbc,0x34,0x95,0x33,0x5a,0x25,0x6a,0x95,
+	0xbd,0x2a,0x55,0xbf,0x54,0x66,0x63,0xf6
+};
+
+static const unsigned char rfc8032_ctx_pk[32] = {
+	0xdf,0xc9,0x42,0x5e,0x4f,0x96,0x8f,0x7f,
+	0x0c,0x29,0xf0,0x25,0x9c,0xf5,0xf9,0xae,
+	0xd6,0x85,0x1c,0x2b,0xb4,0xad,0x8b,0xfb,
+	0x86,0x0c,0xfe,0xe0,0xab,0x24,0x82,0x92
+};
+
+static const unsigned char rfc8032_ctx_m[16] = {
+	0xf7,0x26,0x93,0x6d,0x19,0xc8,0x00,0x49,
+	0x4e,0x3f,0xda,0xff,0x20,0xb2,0x76,0xa8
+};
+
+static const unsigned char rfc8032_ctx_sig[64] = {
+	0x55,0xa4,0xcc,0x2f,0x70,0xa5,0x4e,0x04,
+	0x28,0x8c,0x5f,0x4c,0xd1,0xe4,0x5a,0x7b,
+	0xb5,0x20,0xb3,0x62,0x92,0x91,0x18,0x76,
+	0xca,0xda,0x73,0x23,0x19,0x8d,0xd8,0x7a,
+	0x8b,0x36,0x95,0x0b,0x95,0x13,0x00,0x22,
+	0x90,0x7a,0x7f,0xb7,0xc4,0xe9,0xb2,0xd5,
+	0xf6,0xcc,0xa6,0x85,0xa5,0x87,0xb4,0xb2,
+	0x1f,0x4b,0x88,0x8e,0x4e,0x7e,0xdb,0x0d
+};
+
+/* the same under the 255 byte context 0,1,2..254 */
+static const unsigned char rfc8032_ctx_255_sig[64] = {
+	0x4e,0x8b,0x1d,0xd1,0x14,0x19,0x3f,0xde,
+	0x48,0x5d,0x8a,0x85,0xc1,0x2a,0xfe,0xcb,
+	0x99,0x18,0xfe,0x19,0x37,0xbc,0xa1,0x15,
+	0xe7,0xd6,0x32,0x00,0x92,0x6d,0xd6,0x97,
+	0x61,0xfb,0xd7,0xdc,0x9c,0x6f,0x09,0xf8,
+	0x1c,0xba,0x4d,0x97,0xe8,0xe6,0xf9,0x6c,
+	0x8e,0x28,0xa7,0x76,0x03,0xbb,0xdb,0x35,
+	0xfe,0x98,0x88,0xda,0xb5,0xe5,0x84,0x0c
+};
+
 
 
 /* batch test */
@@ -117,8 +226,9 @@ typedef enum batch_test_t {
 	batch_wrong_sig = 3
 } batch_test;
 
+/* the first 'keys' signers sign every message in turn */
 static int
-test_batch_instance(batch_test type, uint64_t *ticks) {
+test_batch_instance(batch_test type, size_t keys, uint64_t *ticks) {
 	ed25519_secret_key sks[test_batch_count];
 	ed25519_public_key pks[test_batch_count];
 	ed25519_signature sigs[test_batch_count];
@@ -133,8 +243,13 @@ test_batch_instance(batch_test type, uint64_t *ticks) {
 
 	/* generate keys */
 	for (i = 0; i < test_batch_count; i++) {
-		ed25519_randombytes_unsafe(sks[i], sizeof(sks[i]));
-		ed25519_publickey(sks[i], pks[i]);
+		if (i < keys) {
+			ed25519_randombytes_unsafe(sks[i], sizeof(sks[i]));
+			ed25519_publickey(sks[i], pks[i]);
+		} else {
+			memcpy(sks[i], sks[i % keys], sizeof(sks[i]));
+			memcpy(pks[i], pks[i % keys], sizeof(pks[i]));
+		}
 		pk_pointers[i] = pks[i];
 	}
 
@@ -176,24 +291,12 @@ test_batch_instance(batch_test type, uint64_t *ticks) {
 }
 
 static void
-test_batch(void) {
-	uint64_t dummy_ticks, ticks[test_batch_rounds], best = maxticks, sum;
+test_batch_speed(size_t keys, const char *desc) {
+	uint64_t ticks[test_batch_rounds], best = maxticks, sum;
 	size_t i, count;
 
-	/* check the first pass for the expected result */
-	test_batch_instance(batch_no_errors, &dummy_ticks);
-	edassert_equal(batch_verify_y, batch_point_buffer[1], 32, "failed to generate expected result");
-
-	/* make sure ge25519_multi_scalarmult_vartime throws an error on the entire batch with wrong data */
-	for (i = 0; i < 4; i++) {
-		test_batch_instance(batch_wrong_message, &dummy_ticks);
-		test_batch_instance(batch_wrong_pk, &dummy_ticks);
-		test_batch_instance(batch_wrong_sig, &dummy_ticks);
-	}
-
-	/* speed test */
 	for (i = 0; i < test_batch_rounds; i++) {
-		test_batch_instance(batch_no_errors, &ticks[i]);
+		test_batch_instance(batch_no_errors, keys, &ticks[i]);
 		if (ticks[i] < best)
 			best = ticks[i];
 	}
@@ -205,9 +308,42 @@ test_batch(void) {
 			count++;
 		}
 	}
-	printf("%.0f ticks/verification\n", (double)sum / (count * test_batch_count));
+	printf("%.0f ticks/verification%s\n", (double)sum / (count * test_batch_count), desc);
 }
 
+static void
+test_batch(void) {
+	uint64_t dummy_ticks;
+	size_t i;
+
+	/* check the first pass for the expected result */
+	test_batch_instance(batch_no_errors, test_batch_count, &dummy_ticks);
+	edassert_equal(batch_verify_y, batch_point_buffer[1], 32, "failed to generate expected result");
+
+	/* make sure ge25519_multi_scalarmult_boscoster_vartime throws an error on the entire batch with wrong data */
+	for (i = 0; i < 4; i++) {
+		test_batch_instance(batch_wrong_message, test_batch_count, &dummy_ticks);
+		test_batch_instance(batch_wrong_pk, test_batch_count, &dummy_ticks);
+		test_batch_instance(batch_wrong_sig, test_batch_count, &dummy_ticks);
+	}
+
+	/* same with repeated keys, which share a point in the batch */
+	test_batch_instance(batch_no_errors, 4, &dummy_ticks);
+	test_batch_instance(batch_wrong_message, 4, &dummy_ticks);
+	test_batch_instance(batch_wrong_pk, 4, &dummy_ticks);
+	test_batch_instance(batch_wrong_sig, 4, &dummy_ticks);
+	test_batch_instance(batch_no_errors, 1, &dummy_ticks);
+	test_batch_instance(batch_wrong_message, 1, &dummy_ticks);
+	test_batch_instance(batch_wrong_sig, 1, &dummy_ticks);
+
+	/* speed test */
+	test_batch_speed(test_batch_count, "");
+	test_batch_speed(1, " (single key)");
+}
+
+#define test_msm_count 100
+#define test_msm_large 300 /* past the Bos-Coster heap, so the vartime version runs Pippenger */
+
 static void
 test_main(void) {
 	int i, res;
@@ -215,7 +351,14 @@ test_main(void) {
 	ed25519_signature sig;
 	unsigned char forge[1024] = {'x'};
 	curved25519_key csk[2] = {{255}};
-	uint64_t ticks, pkticks = maxticks, signticks = maxticks, openticks = maxticks, curvedticks = maxticks;
+	ed25519_public_key smp[2];
+	unsigned char mse[3][32];
+	const unsigned char *msep[test_msm_large], *mspp[test_msm_large];
+	size_t j, k, step, len, carry;
+	ed25519_sign_open_context openctx;
+	static const unsigned char one[32] = {1};
+	unsigned char *smtable = (unsigned char *)malloc(ED25519_SCALARMULT_TABLE_BYTES(64));
+	uint64_t ticks, pkticks = maxticks, signticks = maxticks, openticks = maxticks, curvedticks = maxticks, scalarmultticks = maxticks, tableticks = maxticks, msmticks = maxticks;
 
 	for (i = 0; i < 1024; i++) {
 		ed25519_publickey(dataset[i].sk, pk);
@@ -231,6 +374,78 @@ test_main(void) {
 		edassert(ed25519_sign_open(forge, (i) ? i : 1, pk, sig), i, "opened forged message");
 	}
 
+	/* streaming verification in pieces of 1..13 bytes, forgeries append a byte */
+	for (i = 0; i < 1024; i++) {
+		memcpy(forge, dataset[i].m, i);
+		forge[i] = 'x';
+		step = (i % 13) + 1;
+		for (j = 0; j < 2; j++) {
+			len = i + j;
+			ed25519_sign_open_init(&openctx, dataset[i].pk, dataset[i].sig);
+			for (k = 0; k < len; k += step)
+				ed25519_sign_open_update(&openctx, forge + k, ((len - k) < step) ? (len - k) : step);
+			edassert((ed25519_sign_open_final(&openctx) == 0) == (j == 0), i, (j) ? "streaming opened forged message" : "failed to stream open message");
+		}
+	}
+
+	/* [1]p = p, [e1]([e2]p) = [e2]([e1]p) */
+	for (i = 0; i < 64; i++) {
+		edassert(!ed25519_scalarmult(smp[0], one, dataset[i].pk), i, "failed to unpack point");
+		edassert_equal_round(dataset[i].pk, smp[0], sizeof(smp[0]), i, "[1]p didn't match p");
+		ed25519_scalarmult(smp[0], dataset[i].sk, dataset[i].pk);
+		ed25519_scalarmult(smp[0], dataset[i + 1].sk, smp[0]);
+		ed25519_scalarmult(smp[1], dataset[i + 1].sk, dataset[i].pk);
+		ed25519_scalarmult(smp[1], dataset[i].sk, smp[1]);
+		edassert_equal_round(smp[0], smp[1], sizeof(smp[0]), i, "variable base scalarmult didn't commute");
+	}
+
+	/* [e1]p + [e2]p = [e1 + e2]p, and both multi scalarmults agree */
+	for (i = 0; i < 64; i++) {
+		memcpy(mse[0], dataset[i].sk, 32);
+		memcpy(mse[1], dataset[i + 1].sk, 32);
+		mse[0][31] = mse[1][31] = 0;
+		for (j = 0, carry = 0; j < 32; j++) {
+			carry += mse[0][j] + mse[1][j];
+			mse[2][j] = (unsigned char)carry;
+			carry >>= 8;
+		}
+		msep[0] = mse[0];
+		msep[1] = mse[1];
+		mspp[0] = mspp[1] = dataset[i].pk;
+		edassert(!ed25519_multi_scalarmult_vartime(smp[0], msep, mspp, 2), i, "failed to unpack points");
+		ed25519_scalarmult(smp[1], mse[2], dataset[i].pk);
+		edassert_equal_round(smp[1], smp[0], sizeof(smp[0]), i, "multi scalarmult didn't match");
+		ed25519_multi_scalarmult(smp[0], msep, mspp, 2);
+		edassert_equal_round(smp[1], smp[0], sizeof(smp[0]), i, "constant time multi scalarmult didn't match");
+	}
+	for (i = 0; i < test_msm_count; i++) {
+		msep[i] = dataset[i].sk;
+		mspp[i] = dataset[i].pk;
+	}
+	ed25519_multi_scalarmult_vartime(smp[0], msep, mspp, test_msm_count);
+	ed25519_multi_scalarmult(smp[1], msep, mspp, test_msm_count);
+	edassert_equal(smp[0], smp[1], sizeof(smp[0]), "multi scalarmults didn't agree");
+	for (i = 0; i < test_msm_large; i++) {
+		msep[i] = dataset[i].sk;
+		mspp[i] = dataset[i].pk;
+	}
+	edassert(!ed25519_multi_scalarmult_vartime(smp[0], msep, mspp, test_msm_large), 0, "failed to unpack points");
+	ed25519_multi_scalarmult(smp[1], msep, mspp, test_msm_large);
+	edassert_equal(smp[0], smp[1], sizeof(smp[0]), "large multi scalarmults didn't agree");
+
+	/* fixed base tables of every size agree with the variable base scalarmult */
+	for (i = 8; i <= 64; i *= 2) {
+		edassert(!ed25519_scalarmult_table_build(smtable, i, dataset[i].pk), i, "failed to build fixed base table");
+		edassert(!ed25519_scalarmult_table(smp[0], dataset[i].sk, smtable, i), i, "fixed base scalarmult rejected a valid table");
+		ed25519_scalarmult(smp[1], dataset[i].sk, dataset[i].pk);
+		edassert_equal_round(smp[1], smp[0], sizeof(smp[0]), i, "fixed base scalarmult didn't match");
+	}
+	for (i = 0; i < 4; i++) {
+		edassert(ed25519_scalarmult_table(smp[0], dataset[0].sk, smtable, i * 3) != 0, i, "fixed base scalarmult took invalid positions");
+		edassert(ed25519_scalarmult_table_build(smtable, i * 3, dataset[0].pk) != 0, i, "fixed base table built with invalid positions");
+	}
+	ed25519_scalarmult_table_build(smtable, 32, pk);
+
 	for (i = 0; i < 1024; i++)
 		curved25519_scalarmult_basepoint(csk[(i & 1) ^ 1], csk[i & 1]);
 	edassert_equal(curved25519_expected, csk[0], sizeof(curved25519_key), "curve25519 failed to generate correct value");
@@ -240,21 +455,911 @@ test_main(void) {
 		edassert_equal_round(dataset[0].pk, pk, sizeof(pk), i, "public key didn't match");
 		timeit(ed25519_sign((unsigned char *)dataset[0].m, 0, dataset[0].sk, pk, sig), signticks)
 		edassert_equal_round(dataset[0].sig, sig, sizeof(sig), i, "signature didn't match");
+#if defined(ED25519_VERIFY_CACHE)
+		ed25519_verify_cache_clear();
+#endif
 		timeit(res = ed25519_sign_open((unsigned char *)dataset[0].m, 0, pk, sig), openticks)
 		edassert(!res, 0, "failed to open message");
 		timeit(curved25519_scalarmult_basepoint(csk[1], csk[0]), curvedticks);
+		timeit(ed25519_scalarmult(smp[0], dataset[0].sk, pk), scalarmultticks);
+		timeit(ed25519_scalarmult_table(smp[0], dataset[0].sk, smtable, 32), tableticks);
+		if (!(i & 31)) {
+			timeit(ed25519_multi_scalarmult_vartime(smp[0], msep, mspp, test_msm_count), msmticks);
+		}
 	}
 
 	printf("%.0f ticks/public key generation\n", (double)pkticks);
 	printf("%.0f ticks/signature\n", (double)signticks);
 	printf("%.0f ticks/signature verification\n", (double)openticks);
 	printf("%.0f ticks/curve25519 basepoint scalarmult\n", (double)curvedticks);
+	printf("%.0f ticks/variable base scalarmult\n", (double)scalarmultticks);
+	printf("%.0f ticks/fixed base table scalarmult\n", (double)tableticks);
+	printf("%.0f ticks/point in a %d point multi scalarmult\n", (double)msmticks / test_msm_count, test_msm_count);
+
+	free(smtable);
+}
+
+/* runs after test_batch, batch_verify_y depends on the random bytes batches consume */
+static void
+test_iovec(void) {
+	ed25519_iovec segments[64][3];
+	const ed25519_iovec *segmentp[64];
+	size_t segmentcnt[64];
+	const unsigned char *batchpk[64], *batchsig[64];
+	int batchvalid[64];
+	ed25519_signature sig;
+	size_t i, j;
+
+	/* the message split in header, body and trailer segments */
+	for (i = 0; i < 1024; i++) {
+		for (j = 0; j < 3; j++) {
+			segments[i & 63][j].iov_base = dataset[i].m + (i * j) / 3;
+			segments[i & 63][j].iov_len = (i * (j + 1)) / 3 - (i * j) / 3;
+		}
+		ed25519_sign_iov(segments[i & 63], 3, dataset[i].sk, dataset[i].pk, sig);
+		edassert_equal_round(dataset[i].sig, sig, sizeof(sig), (int)i, "iovec signature didn't match");
+		edassert(!ed25519_sign_open_iov(segments[i & 63], 3, dataset[i].pk, sig), (int)i, "failed to open iovec message");
+		edassert(ed25519_sign_open_iov(segments[i & 63], 2, dataset[i].pk, sig) == ((i) ? -1 : 0), (int)i, "opened iovec message without its trailer");
+
+		if ((i & 63) == 63) {
+			for (j = 0; j < 64; j++) {
+				segmentp[j] = segments[j];
+				segmentcnt[j] = 3;
+				batchpk[j] = dataset[i - 63 + j].pk;
+				batchsig[j] = dataset[i - 63 + j].sig;
+			}
+			edassert(!ed25519_sign_open_batch_iov(segmentp, segmentcnt, batchpk, batchsig, 64, batchvalid), (int)i, "failed to batch open iovec messages");
+			segmentcnt[5] = 2;
+			edassert(ed25519_sign_open_batch_iov(segmentp, segmentcnt, batchpk, batchsig, 64, batchvalid) != 0, (int)i, "batch opened iovec message without its trailer");
+			for (j = 0; j < 64; j++)
+				edassert(batchvalid[j] == (j != 5), (int)i, "batch marked the wrong iovec message as forged");
+		}
+	}
+}
+
+/* groups of 1..37 signatures, so every window size and a partial last window come up */
+static void
+test_sign_batch(void) {
+	const unsigned char *m[37], *sk[37], *pk[37];
+	unsigned char *sigp[37];
+	size_t mlen[37];
+	ed25519_signature sigs[37];
+	size_t i, j, n;
+	uint64_t ticks, batchticks = maxticks;
+
+	for (i = 0; i < 1024; i += n) {
+		n = (i % 37) + 1;
+		if (n > (1024 - i))
+			n = 1024 - i;
+		for (j = 0; j < n; j++) {
+			m[j] = (const unsigned char *)dataset[i + j].m;
+			mlen[j] = i + j;
+			sk[j] = dataset[i + j].sk;
+			pk[j] = dataset[i + j].pk;
+			sigp[j] = sigs[j];
+		}
+		ed25519_sign_batch(m, mlen, sk, pk, sigp, n);
+		for (j = 0; j < n; j++)
+			edassert_equal_round(dataset[i + j].sig, sigs[j], 64, (int)(i + j), "batch signature didn't match");
+	}
+
+	for (j = 0; j < 16; j++) {
+		m[j] = (const unsigned char *)dataset[j].m;
+		mlen[j] = j;
+		sk[j] = dataset[j].sk;
+		pk[j] = dataset[j].pk;
+	}
+	for (i = 0; i < 128; i++) {
+		timeit(ed25519_sign_batch(m, mlen, sk, pk, sigp, 16), batchticks)
+	}
+	printf("%.0f ticks/signature in a batch of 16\n", (double)batchticks / 16);
+}
+
+/* Ed25519ctx batch when ctx is set, Ed25519ph otherwise */
+static int
+test_rfc8032_batch(size_t ctx, const unsigned char **prehash, const unsigned char **m, size_t *mlen, const unsigned char **ctxp, size_t *ctxlen, const unsigned char **pk, const unsigned char **RS, int *valid) {
+	if (ctx)
+		return ed25519ctx_sign_open_batch(m, mlen, ctxp, ctxlen, pk, RS, 64, valid);
+	return ed25519ph_sign_open_batch(prehash, ctxp, ctxlen, pk, RS, 64, valid);
+}
+
+/* RFC 8032 vectors for Ed25519ph and Ed25519ctx, and their batch verification */
+static void
+test_rfc8032(void) {
+	unsigned char ctx255[256], prehash[64], prehashes[64][64];
+	const unsigned char *prehashp[64], *mp[64], *ctxp[64], *pkp[64], *sigp[64];
+	size_t ml[64], ctxlen[64];
+	ed25519_signature sig, sigs[64];
+	ed25519ph_context ph;
+	int valid[64];
+	size_t i, j;
+
+	for (i = 0; i < 256; i++)
+		ctx255[i] = (unsigned char)i;
+
+	/* Ed25519ph, with the prehash fed a byte at a time */
+	ed25519ph_init(&ph);
+	for (i = 0; i < 3; i++)
+		ed25519ph_update(&ph, (const unsigned char *)"abc" + i, 1);
+	ed25519ph_final(&ph, prehash);
+	edassert(!ed25519ph_sign(prehash, NULL, 0, rfc8032_ph_sk, rfc8032_ph_pk, sig), 0, "Ed25519ph failed to sign");
+	edassert_equal(rfc8032_ph_sig, sig, 64, "Ed25519ph signature didn't match");
+	edassert(!ed25519ph_sign_open(prehash, NULL, 0, rfc8032_ph_pk, sig), 0, "failed to open Ed25519ph message");
+	edassert(ed25519_sign_open(prehash, 64, rfc8032_ph_pk, sig) != 0, 0, "opened Ed25519ph signature as Ed25519");
+	edassert(!ed25519ph_sign(prehash, (const unsigned char *)"foo", 3, rfc8032_ph_sk, rfc8032_ph_pk, sig), 0, "Ed25519ph failed to sign");
+	edassert_equal(rfc8032_ph_foo_sig, sig, 64, "Ed25519ph signature with a context didn't match");
+	edassert(ed25519ph_sign_open(prehash, NULL, 0, rfc8032_ph_pk, sig) != 0, 0, "opened Ed25519ph message without its context");
+
+	/* Ed25519ctx */
+	edassert(!ed25519ctx_sign(rfc8032_ctx_m, 16, (const unsigned char *)"foo", 3, rfc8032_ctx_sk, rfc8032_ctx_pk, sig), 0, "Ed25519ctx failed to sign");
+	edassert_equal(rfc8032_ctx_sig, sig, 64, "Ed25519ctx signature didn't match");
+	edassert(!ed25519ctx_sign_open(rfc8032_ctx_m, 16, (const unsigned char *)"foo", 3, rfc8032_ctx_pk, sig), 0, "failed to open Ed25519ctx message");
+	edassert(ed25519ctx_sign_open(rfc8032_ctx_m, 16, (const unsigned char *)"bar", 3, rfc8032_ctx_pk, sig) != 0, 0, "opened Ed25519ctx message under the wrong context");
+	edassert(ed25519_sign_open(rfc8032_ctx_m, 16, rfc8032_ctx_pk, sig) != 0, 0, "opened Ed25519ctx signature as Ed25519");
+	edassert(!ed25519ctx_sign(rfc8032_ctx_m, 16, ctx255, 255, rfc8032_ctx_sk, rfc8032_ctx_pk, sig), 0, "Ed25519ctx failed to sign with a 255 byte context");
+	edassert_equal(rfc8032_ctx_255_sig, sig, 64, "Ed25519ctx signature with a 255 byte context didn't match");
+	edassert(ed25519ctx_sign(rfc8032_ctx_m, 16, ctx255, 256, rfc8032_ctx_sk, rfc8032_ctx_pk, sig) != 0, 0, "Ed25519ctx signed with a 256 byte context");
+	edassert(ed25519ctx_sign_open(rfc8032_ctx_m, 16, ctx255, 256, rfc8032_ctx_pk, rfc8032_ctx_255_sig) != 0, 0, "opened Ed25519ctx message with a 256 byte context");
+
+	/* batches, signature i is under the context 0,1..i-1 */
+	for (i = 0; i < 64; i++) {
+		ed25519ph_init(&ph);
+		ed25519ph_update(&ph, (const unsigned char *)dataset[i].m, i);
+		ed25519ph_final(&ph, prehashes[i]);
+		prehashp[i] = prehashes[i];
+		mp[i] = (const unsigned char *)dataset[i].m;
+		ml[i] = i;
+		ctxp[i] = ctx255;
+		ctxlen[i] = i;
+		pkp[i] = dataset[i].pk;
+		sigp[i] = sigs[i];
+	}
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < 64; i++) {
+			ctxlen[i] = i;
+			if (j)
+				ed25519ctx_sign(mp[i], i, ctx255, i, dataset[i].sk, dataset[i].pk, sigs[i]);
+			else
+				ed25519ph_sign(prehashes[i], ctx255, i, dataset[i].sk, dataset[i].pk, sigs[i]);
+		}
+
+		edassert(!test_rfc8032_batch(j, prehashp, mp, ml, ctxp, ctxlen, pkp, sigp, valid), (int)j, "failed to batch open messages with contexts");
+		ctxlen[9] = 10;
+		ctxlen[17] = 256;
+		edassert(test_rfc8032_batch(j, prehashp, mp, ml, ctxp, ctxlen, pkp, sigp, valid) != 0, (int)j, "batch opened messages under the wrong context");
+		for (i = 0; i < 64; i++)
+			edassert(valid[i] == ((i != 9) && (i != 17)), (int)i, "batch marked the wrong message as forged");
+	}
+}
+
+/* the first 130 dataset entries packed in to contiguous buffers, checked against a bitset */
+static void
+test_batch_packed(void) {
+	unsigned char *blob = (unsigned char *)malloc(130 * 130), *pks = (unsigned char *)malloc(130 * 32), *sigs = (unsigned char *)malloc(130 * 64);
+	unsigned char valid[(130 + 7) / 8];
+	size_t offsets[131];
+	size_t i, forged;
+
+	for (i = 0, offsets[0] = 0; i < 130; i++) {
+		memcpy(blob + offsets[i], dataset[i].m, i);
+		offsets[i + 1] = offsets[i] + i;
+		memcpy(pks + i * 32, dataset[i].pk, 32);
+		memcpy(sigs + i * 64, dataset[i].sig, 64);
+	}
+
+	edassert(!ed25519_sign_open_batch_packed(blob, offsets, pks, sigs, 130, valid), 0, "failed to batch open packed messages");
+	for (i = 0; i < 130; i++)
+		edassert(valid[i / 8] & (1 << (i & 7)), (int)i, "packed message not marked valid");
+
+	/* one forgery per window, and in the 2 signature tail */
+	for (forged = 3; forged < 130; forged += 63) {
+		sigs[forged * 64] ^= 1;
+		edassert(ed25519_sign_open_batch_packed(blob, offsets, pks, sigs, 130, valid) != 0, (int)forged, "batch opened forged packed message");
+		for (i = 0; i < 130; i++)
+			edassert(((valid[i / 8] >> (i & 7)) & 1) == (i != forged), (int)i, "packed batch marked the wrong message as forged");
+		sigs[forged * 64] ^= 1;
+	}
+
+	free(blob);
+	free(pks);
+	free(sigs);
+}
+
+/* the first 130 dataset entries through a context in unaligned heap memory */
+static void
+test_batch_context(void) {
+	size_t size = ed25519_batch_context_size(), i, forged;
+	unsigned char *memory = (unsigned char *)malloc(size + 1), forgery[64];
+	const unsigned char *mp[130], *pkp[130], *sigp[130];
+	size_t ml[130];
+	ed25519_iovec segment[130];
+	const ed25519_iovec *segmentp[130];
+	size_t segmentcnt[130];
+	int valid[130];
+	ed25519_batch_context *ctx;
+
+	edassert(ed25519_batch_context_init(memory + 1, size - 64) == NULL, 0, "placed batch context in too little memory");
+	ctx = ed25519_batch_context_init(memory + 1, size);
+	edassert(ctx != NULL, 0, "failed to place batch context");
+
+	for (i = 0; i < 130; i++) {
+		mp[i] = (const unsigned char *)dataset[i].m;
+		ml[i] = i;
+		pkp[i] = dataset[i].pk;
+		sigp[i] = dataset[i].sig;
+		segment[i].iov_base = dataset[i].m;
+		segment[i].iov_len = i;
+		segmentp[i] = &segment[i];
+		segmentcnt[i] = 1;
+	}
+
+	edassert(!ed25519_sign_open_batch_ctx(ctx, mp, ml, pkp, sigp, 130, valid), 0, "failed to batch open messages with a context");
+	edassert(!ed25519_sign_open_batch_iov_ctx(ctx, segmentp, segmentcnt, pkp, sigp, 130, valid), 0, "failed to batch open iovec messages with a context");
+
+	/* one forgery per window, and in the 2 signature tail */
+	for (forged = 3; forged < 130; forged += 63) {
+		memcpy(forgery, dataset[forged].sig, 64);
+		forgery[0] ^= 1;
+		sigp[forged] = forgery;
+		edassert(ed25519_sign_open_batch_ctx(ctx, mp, ml, pkp, sigp, 130, valid) != 0, (int)forged, "batch opened forged message with a context");
+		for (i = 0; i < 130; i++)
+			edassert(valid[i] == (i != forged), (int)i, "context batch marked the wrong message as forged");
+		sigp[forged] = dataset[forged].sig;
+	}
+
+	free(memory);
+}
+
+static void
+test_batch_accumulator_result(void *arg, void *tag, int valid) {
+	*(size_t *)arg += 1;
+	*(int *)tag = valid;
+}
+
+/* the first 150 dataset entries added one at a time, with a forgery and an unreduced S */
+static void
+test_batch_accumulator(void) {
+	static const size_t thresholds[] = {0, 3, 17};
+	size_t size = ed25519_batch_accumulator_size(), i, t, results;
+	unsigned char *memory = (unsigned char *)malloc(size), sig[64];
+	ed25519_batch_accumulator *acc;
+	int valid[150];
+
+	for (t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+		acc = ed25519_batch_accumulator_init(memory, size, thresholds[t], test_batch_accumulator_result, &results);
+		edassert(acc != NULL, (int)t, "failed to place batch accumulator");
+
+		results = 0;
+		for (i = 0; i < 150; i++) {
+			valid[i] = -1;
+			memcpy(sig, dataset[i].sig, 64);
+			if (i == 70)
+				sig[0] ^= 1;
+			if (i == 10)
+				sig[63] |= 0x80;
+			ed25519_batch_accumulator_add(acc, (const unsigned char *)dataset[i].m, i, dataset[i].pk, sig, &valid[i]);
+		}
+		edassert(ed25519_batch_accumulator_flush(acc) == 0, (int)t, "accumulator flush reported a forgery");
+		edassert(results == 150, (int)t, "accumulator didn't report every signature once");
+		for (i = 0; i < 150; i++)
+			edassert(valid[i] == ((i != 70) && (i != 10)), (int)i, "accumulator reported the wrong result");
+		edassert(ed25519_batch_accumulator_flush(acc) == 0 && (results == 150), (int)t, "empty accumulator flush reported results");
+	}
+
+	free(memory);
+}
+
+/* a log of the first 200 dataset entries as pk || sig || mlen || m records */
+static void
+test_sign_open_log(void) {
+	unsigned char *log = (unsigned char *)malloc(200 * (100 + 200));
+	size_t offsets[201], verified;
+	size_t i;
+
+	for (i = 0, offsets[0] = 0; i < 200; i++) {
+		memcpy(log + offsets[i], dataset[i].pk, 32);
+		memcpy(log + offsets[i] + 32, dataset[i].sig, 64);
+		log[offsets[i] + 96] = (unsigned char)i;
+		log[offsets[i] + 97] = (unsigned char)(i >> 8);
+		log[offsets[i] + 98] = 0;
+		log[offsets[i] + 99] = 0;
+		memcpy(log + offsets[i] + 100, dataset[i].m, i);
+		offsets[i + 1] = offsets[i] + 100 + i;
+	}
+
+	edassert(!ed25519_sign_open_log(log, offsets[200], &verified) && (verified == offsets[200]), 0, "failed to open log");
+
+	/* a partial record at the end is left unverified */
+	edassert(!ed25519_sign_open_log(log, offsets[200] - 1, &verified) && (verified == offsets[199]), 0, "opened partial log record");
+	edassert(!ed25519_sign_open_log(log, offsets[199] + 50, &verified) && (verified == offsets[199]), 0, "opened partial log record header");
+
+	/* stops at the first invalid record */
+	log[offsets[150] + 100] ^= 1;
+	log[offsets[170] + 100] ^= 1;
+	edassert(ed25519_sign_open_log(log, offsets[200], &verified) && (verified == offsets[150]), 0, "opened forged log record");
+
+	free(log);
+}
+
+/* a verify cache would answer the repeated opens before they reach the key cache */
+/* records prepared a message at a time, checked alone and in batches of 130 with forgeries at 3, 66 and 129 */
+static void
+test_prepared(void) {
+	static ed25519_prepared_signature prepared[130];
+	unsigned char forge[1024];
+	int valid[130];
+	size_t i, j;
+
+	for (i = 0; i < 1024; i++) {
+		j = i % 130;
+		edassert(!ed25519_sign_open_prepare((unsigned char *)dataset[i].m, i, dataset[i].pk, dataset[i].sig, &prepared[j]), (int)i, "failed to prepare signature");
+		edassert(!ed25519_sign_open_prepared(&prepared[j]), (int)i, "failed to open prepared signature");
+		if ((j == 3) || (j == 66) || (j == 129)) {
+			memcpy(forge, dataset[i].m, i);
+			forge[0] ^= 1;
+			edassert(!ed25519_sign_open_prepare(forge, (i) ? i : 1, dataset[i].pk, dataset[i].sig, &prepared[j]), (int)i, "failed to prepare forged signature");
+			edassert(ed25519_sign_open_prepared(&prepared[j]) != 0, (int)i, "opened prepared forgery");
+		}
+		if (j == 129) {
+			edassert(ed25519_sign_open_batch_prepared(prepared, 130, valid) != 0, (int)i, "batch opened prepared forgeries");
+			for (j = 0; j < 130; j++)
+				edassert(valid[j] == ((j != 3) && (j != 66) && (j != 129)), (int)i, "batch marked the wrong prepared signature as forged");
+		}
+	}
+
+	/* S with the top bits set is turned away by both stages, prepared[3] is still a forgery */
+	memcpy(forge, dataset[5].sig, 64);
+	forge[63] |= 0x80;
+	edassert(ed25519_sign_open_prepare((unsigned char *)dataset[5].m, 5, dataset[5].pk, forge, &prepared[0]) != 0, 5, "prepared a signature with an unreduced S");
+	edassert(ed25519_sign_open_batch_prepared(prepared, 64, valid) != 0, 5, "batch opened a prepared signature with an unreduced S");
+	for (j = 0; j < 64; j++)
+		edassert(valid[j] == ((j != 0) && (j != 3)), (int)j, "batch marked the wrong prepared signature as forged");
+}
+
+#if defined(ED25519_KEY_CACHE) && !defined(ED25519_VERIFY_CACHE)
+static void
+test_key_cache(void) {
+	static const ed25519_public_key bad_pk = {2}; /* y = 2 is not on the curve */
+	ed25519_signature sig;
+	size_t hits, misses, i, round;
+	uint64_t ticks, cachedticks = maxticks;
+
+	ed25519_key_cache_clear();
+
+	/* a miss, then a hit */
+	for (i = 0; i < 2; i++)
+		edassert(!ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), (int)i, "failed to open message with the key cache");
+	ed25519_key_cache_stats(&hits, &misses);
+	edassert((hits == 1) && (misses == 1), 0, "key cache didn't hit");
+
+	/* cached keys must still reject forgeries */
+	memcpy(sig, dataset[1].sig, 64);
+	sig[0] ^= 1;
+	edassert(ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, sig) != 0, 0, "opened forged message with a cached key");
+
+	/* keys that don't decompress are never cached */
+	for (i = 0; i < 2; i++)
+		edassert(ed25519_sign_open((unsigned char *)dataset[1].m, 1, bad_pk, dataset[1].sig) != 0, (int)i, "opened message with an invalid key");
+	ed25519_key_cache_stats(&hits, &misses);
+	edassert((hits == 2) && (misses == 3), 0, "invalid key was cached");
+
+	/* more keys than the cache holds, so entries are evicted and refilled */
+	for (round = 0; round < 2; round++)
+		for (i = 0; i < 1024; i++)
+			edassert(!ed25519_sign_open((unsigned char *)dataset[i].m, i, dataset[i].pk, dataset[i].sig), (int)i, "failed to open message after eviction");
+	ed25519_key_cache_stats(&hits, &misses);
+	edassert((hits + misses) == (3 + 2 + 2048), 0, "key cache counters are off");
+
+	for (i = 0; i < 256; i++) {
+		timeit(ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), cachedticks)
+	}
+	printf("%.0f ticks/signature verification (cached key)\n", (double)cachedticks);
+}
+#endif
+
+#if defined(ED25519_VERIFY_CACHE)
+static void
+test_verify_cache(void) {
+	const unsigned char *mp[64], *pkp[64], *sigp[64];
+	size_t ml[64];
+	int valid[64];
+	static const unsigned char l[32] = {
+		0xed,0xd3,0xf5,0x5c,0x1a,0x63,0x12,0x58,0xd6,0x9c,0xf7,0xa2,0xde,0xf9,0xde,0x14,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10
+	};
+	ed25519_signature sig, forged[1024];
+#if !defined(ED25519_COFACTORED)
+	unsigned char ncpk[32], ncsig[64];
+#endif
+	size_t hits, misses, i, carry;
+	uint64_t ticks, cachedticks = maxticks;
+
+	ed25519_verify_cache_clear();
+
+	/* a miss, then a hit */
+	for (i = 0; i < 2; i++)
+		edassert(!ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), (int)i, "failed to open message with the verify cache");
+	ed25519_verify_cache_stats(&hits, &misses);
+	edassert((hits == 1) && (misses == 1), 0, "verify cache didn't hit");
+
+	/* failures are remembered too, and never mistaken for the valid signature */
+	memcpy(sig, dataset[1].sig, 64);
+	sig[0] ^= 1;
+	for (i = 0; i < 2; i++)
+		edassert(ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, sig) != 0, (int)i, "opened forged message with the verify cache");
+	ed25519_verify_cache_stats(&hits, &misses);
+	edassert((hits == 2) && (misses == 2), 0, "verify cache didn't remember a failure");
+
+	/* a flood of forgeries can't push out a valid result */
+	for (i = 0; i < 1024; i++) {
+		memcpy(forged[i], dataset[i].sig, 64);
+		forged[i][0] ^= 1;
+		edassert(ed25519_sign_open((unsigned char *)dataset[i].m, i, dataset[i].pk, forged[i]) != 0, (int)i, "opened forged message");
+	}
+	edassert(!ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), 0, "failed to open message after a flood of forgeries");
+	ed25519_verify_cache_stats(&hits, &misses);
+	edassert(hits == 4, 0, "forgeries evicted a valid result");
+
+	/* a batch fills the cache, the same batch again is answered from it */
+	for (i = 0; i < 64; i++) {
+		mp[i] = (unsigned char *)dataset[i + 64].m;
+		ml[i] = i + 64;
+		pkp[i] = dataset[i + 64].pk;
+		sigp[i] = dataset[i + 64].sig;
+	}
+	edassert(!ed25519_sign_open_batch(mp, ml, pkp, sigp, 64, valid), 0, "failed to batch open messages");
+	ed25519_verify_cache_stats(&hits, &misses);
+	edassert(hits == 4, 0, "batch hit a cold verify cache");
+	sigp[7] = forged[71];
+	edassert(ed25519_sign_open_batch(mp, ml, pkp, sigp, 64, valid) == 1, 0, "batch opened a forged message");
+	for (i = 0; i < 64; i++)
+		edassert(valid[i] == (i != 7), (int)i, "batch marked the wrong signature as forged");
+	ed25519_verify_cache_stats(&hits, &misses);
+#if defined(ED25519_COFACTORED)
+	edassert(hits == (4 + 64), 0, "batch didn't hit the verify cache");
+#else
+	/* a cofactorless batch that passed is not remembered, only the forgery hits. single checks are */
+	edassert(hits == (4 + 1), 0, "verify cache remembered a cofactorless batch");
+	for (i = 0; i < 64; i++)
+		edassert((ed25519_sign_open(mp[i], ml[i], pkp[i], sigp[i]) == 0) == (i != 7), (int)i, "single check disagreed with the batch");
+	edassert(ed25519_sign_open_batch(mp, ml, pkp, sigp, 64, valid) == 1, 0, "batch opened a forged message");
+	ed25519_verify_cache_stats(&hits, &misses);
+	edassert(hits == (4 + 1 + 1 + 64), 0, "batch didn't hit the verify cache");
+#endif
+
+	/* S + 2l in an otherwise valid batch is never remembered as valid for a single check */
+	for (i = 0; i < 64; i++) {
+		mp[i] = (unsigned char *)dataset[i + 128].m;
+		ml[i] = i + 128;
+		pkp[i] = dataset[i + 128].pk;
+		sigp[i] = dataset[i + 128].sig;
+	}
+	memcpy(sig, dataset[128 + 9].sig, 64);
+	for (i = 0, carry = 0; i < 32; i++) {
+		carry += (size_t)sig[32 + i] + 2 * (size_t)l[i];
+		sig[32 + i] = (unsigned char)carry;
+		carry >>= 8;
+	}
+	sigp[9] = sig;
+	edassert(ed25519_sign_open_batch(mp, ml, pkp, sigp, 64, valid) == 1, 0, "batch opened a message with S + 2l");
+	for (i = 0; i < 64; i++)
+		edassert(valid[i] == (i != 9), (int)i, "batch marked the wrong signature as invalid");
+	edassert(ed25519_sign_open(mp[9], ml[9], pkp[9], sig) != 0, 0, "opened a message with S + 2l after a batch");
+
+#if !defined(ED25519_COFACTORED)
+	/* R = identity encoded as y = p + 1 under A = identity and S = 0 passes the batch equation, never ed25519_sign_open */
+	for (i = 0; i < 64; i++) {
+		mp[i] = (unsigned char *)dataset[i + 192].m;
+		ml[i] = i + 192;
+		pkp[i] = dataset[i + 192].pk;
+		sigp[i] = dataset[i + 192].sig;
+	}
+	memset(ncpk, 0, 32);
+	ncpk[0] = 1;
+	memset(ncsig, 0, 64);
+	memset(ncsig, 0xff, 32);
+	ncsig[0] = 0xee;
+	ncsig[31] = 0x7f;
+	pkp[9] = ncpk;
+	sigp[9] = ncsig;
+	edassert(!ed25519_sign_open_batch(mp, ml, pkp, sigp, 64, valid), 0, "batch turned away a non canonical R");
+	edassert(ed25519_sign_open(mp[9], ml[9], ncpk, ncsig) != 0, 0, "opened a non canonical R after a batch");
+#endif
+
+	for (i = 0; i < 256; i++) {
+		timeit(ed25519_sign_open((unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), cachedticks)
+	}
+	printf("%.0f ticks/signature verification (cached result)\n", (double)cachedticks);
+}
+#endif
+
+#if defined(ED25519_VERIFY_SERVICE)
+static void
+test_verify_service_result(void *arg, void *tag, int valid) {
+	(void)arg;
+	*(int *)tag = valid;
+}
+
+/* blocking opens, then 200 submissions against a 64 slot queue, with a forgery */
+static void
+test_verify_service(void) {
+	ed25519_verify_service *svc = ed25519_verify_service_create(2, 64, 2000);
+	unsigned char forgery[64];
+	int valid[200];
+	size_t i;
+
+	edassert(svc != NULL, 0, "failed to start verify service");
+	for (i = 0; i < 8; i++)
+		edassert(!ed25519_verify_service_sign_open(svc, (unsigned char *)dataset[i].m, i, dataset[i].pk, dataset[i].sig), (int)i, "verify service failed to open message");
+	memcpy(forgery, dataset[77].sig, 64);
+	forgery[0] ^= 1;
+	edassert(ed25519_verify_service_sign_open(svc, (unsigned char *)dataset[77].m, 77, dataset[77].pk, forgery), 77, "verify service opened forged message");
+
+	for (i = 0; i < 200; i++) {
+		valid[i] = -1;
+		if (ed25519_verify_service_submit(svc, (unsigned char *)dataset[i].m, i, dataset[i].pk, (i == 77) ? forgery : dataset[i].sig, test_verify_service_result, NULL, &valid[i]) != 0)
+			valid[i] = !ed25519_sign_open((unsigned char *)dataset[i].m, i, dataset[i].pk, (i == 77) ? forgery : dataset[i].sig);
+	}
+	ed25519_verify_service_destroy(svc);
+	for (i = 0; i < 200; i++)
+		edassert(valid[i] == (i != 77), (int)i, "verify service reported the wrong result");
+}
+
+typedef struct test_priority_t {
+	pthread_mutex_t gate;
+	size_t finished, order[129];
+	int valid[129];
+} test_priority;
+
+/* the first bulk signature holds its worker at the gate */
+static void
+test_verify_service_priority_result(void *arg, void *tag, int valid) {
+	test_priority *t = (test_priority *)arg;
+	size_t i = (size_t)((int *)tag - t->valid);
+
+	if (i == 0) {
+		pthread_mutex_lock(&t->gate);
+		pthread_mutex_unlock(&t->gate);
+	}
+	t->valid[i] = valid;
+	t->order[i] = t->finished++;
+}
+
+/* an interactive signature submitted behind 128 bulk ones overtakes most of them */
+static void
+test_verify_service_priority(void) {
+	ed25519_verify_service *svc = ed25519_verify_service_create(1, 256, 2000);
+	ed25519_service_stats bulk, interactive;
+	static test_priority t;
+	unsigned long long waits;
+	size_t i;
+
+	edassert(svc != NULL, 0, "failed to start verify service");
+	edassert(!ed25519_verify_service_sign_open_priority(svc, ED25519_PRIORITY_INTERACTIVE, (unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), 1, "verify service failed to open interactive message");
+	ed25519_verify_service_stats(svc, ED25519_PRIORITY_INTERACTIVE, &interactive);
+	for (i = 0, waits = 0; i < 24; i++)
+		waits += interactive.wait_us_log2[i];
+	edassert((interactive.completed == 1) && (interactive.depth == 0) && (waits == 1), 1, "verify service stats didn't count the interactive signature");
+
+	pthread_mutex_init(&t.gate, NULL);
+	pthread_mutex_lock(&t.gate);
+	for (i = 0; i < 128; i++)
+		edassert(!ed25519_verify_service_submit(svc, (unsigned char *)dataset[i].m, i, dataset[i].pk, dataset[i].sig, test_verify_service_priority_result, &t, &t.valid[i]), (int)i, "verify service queue was full");
+	edassert(!ed25519_verify_service_submit_priority(svc, ED25519_PRIORITY_INTERACTIVE, (unsigned char *)dataset[200].m, 200, dataset[200].pk, dataset[200].sig, test_verify_service_priority_result, &t, &t.valid[128]), 128, "verify service queue was full");
+	ed25519_verify_service_stats(svc, ED25519_PRIORITY_BULK, &bulk);
+	edassert((bulk.depth >= 64) && (bulk.completed <= 64), 0, "verify service stats didn't count the bulk queue");
+	pthread_mutex_unlock(&t.gate);
+	ed25519_verify_service_destroy(svc);
+	pthread_mutex_destroy(&t.gate);
+
+	for (i = 0; i < 129; i++)
+		edassert(t.valid[i] == 1, (int)i, "verify service reported the wrong result");
+	edassert(t.order[128] < t.order[127], 128, "interactive signature waited for the bulk queue");
+}
+#endif
+
+#if defined(ED25519_SIGN_SERVICE)
+static void
+test_sign_service_result(void *arg, void *tag, int valid) {
+	(void)arg;
+	*(int *)tag = valid;
+}
+
+/* blocking bulk and interactive signs, then 200 submissions under 200 keys, every 10th interactive, against a 64 slot queue */
+static void
+test_sign_service(void) {
+	ed25519_sign_service *svc = ed25519_sign_service_create(2, 64, 2000);
+	static ed25519_signature sigs[200];
+	ed25519_service_stats stats;
+	unsigned long long waits;
+	int done[200];
+	size_t i;
+
+	edassert(svc != NULL, 0, "failed to start sign service");
+	for (i = 0; i < 8; i++) {
+		ed25519_sign_service_sign(svc, (unsigned char *)dataset[i].m, i, dataset[i].sk, dataset[i].pk, sigs[i]);
+		edassert_equal_round(dataset[i].sig, sigs[i], 64, (int)i, "sign service signature didn't match");
+	}
+	ed25519_sign_service_stats(svc, ED25519_PRIORITY_BULK, &stats);
+	edassert((stats.completed == 8) && (stats.depth == 0), 0, "sign service stats didn't count the signatures");
+
+	/* interactive signs are counted in their own class */
+	for (i = 8; i < 12; i++) {
+		ed25519_sign_service_sign_priority(svc, ED25519_PRIORITY_INTERACTIVE, (unsigned char *)dataset[i].m, i, dataset[i].sk, dataset[i].pk, sigs[i]);
+		edassert_equal_round(dataset[i].sig, sigs[i], 64, (int)i, "sign service interactive signature didn't match");
+	}
+	ed25519_sign_service_stats(svc, ED25519_PRIORITY_INTERACTIVE, &stats);
+	for (i = 0, waits = 0; i < 24; i++)
+		waits += stats.wait_us_log2[i];
+	edassert((stats.completed == 4) && (stats.depth == 0) && (waits == 4), 0, "sign service stats didn't count the interactive signatures");
+	ed25519_sign_service_stats(svc, ED25519_PRIORITY_BULK, &stats);
+	edassert(stats.completed == 8, 0, "sign service counted interactive signatures as bulk");
+
+	memset(sigs, 0, sizeof(sigs));
+	for (i = 0; i < 200; i++) {
+		done[i] = 0;
+		if (ed25519_sign_service_submit_priority(svc, (i % 10) ? ED25519_PRIORITY_BULK : ED25519_PRIORITY_INTERACTIVE, (unsigned char *)dataset[i].m, i, dataset[i].sk, dataset[i].pk, sigs[i], test_sign_service_result, NULL, &done[i]) != 0) {
+			ed25519_sign((unsigned char *)dataset[i].m, i, dataset[i].sk, dataset[i].pk, sigs[i]);
+			done[i] = 1;
+		}
+	}
+	ed25519_sign_service_destroy(svc);
+	for (i = 0; i < 200; i++) {
+		edassert(done[i] == 1, (int)i, "sign service didn't finish a signature");
+		edassert_equal_round(dataset[i].sig, sigs[i], 64, (int)i, "sign service signature didn't match");
+	}
+}
+#endif
+
+#if defined(ED25519_SPLIT_VERIFY)
+/* agrees with ed25519_sign_open on keys being added to the verifier, keys already in it, forgeries and bad keys */
+static void
+test_split_verify(void) {
+	static const ed25519_public_key bad_pk = {2}; /* y = 2 is not on the curve */
+	ed25519_split_verifier *v = ed25519_split_verifier_create();
+	ed25519_signature sig;
+	size_t i, round;
+	uint64_t ticks, splitticks = maxticks;
+
+	edassert(v != NULL, 0, "failed to start split verifier");
+	for (i = 0; i < 1024; i++)
+		edassert(!ed25519_split_verifier_sign_open(v, (unsigned char *)dataset[i].m, i, dataset[i].pk, dataset[i].sig), (int)i, "split verifier failed to open message");
+
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < 16; i++) {
+			edassert(!ed25519_split_verifier_sign_open(v, (unsigned char *)dataset[i].m, i, dataset[i].pk, dataset[i].sig), (int)i, "split verifier failed to open message with a known key");
+			memcpy(sig, dataset[i].sig, 64);
+			sig[(round * 16 + i) % 64] ^= 1;
+			edassert(ed25519_split_verifier_sign_open(v, (unsigned char *)dataset[i].m, i, dataset[i].pk, sig) != 0, (int)i, "split verifier opened forged message");
+		}
+	}
+
+	memcpy(sig, dataset[5].sig, 64);
+	sig[63] |= 0x80;
+	edassert(ed25519_split_verifier_sign_open(v, (unsigned char *)dataset[5].m, 5, dataset[5].pk, sig) != 0, 5, "split verifier opened a signature with an unreduced S");
+	edassert(ed25519_split_verifier_sign_open(v, (unsigned char *)dataset[5].m, 5, bad_pk, dataset[5].sig) != 0, 5, "split verifier opened message with an invalid key");
+
+	for (i = 0; i < 256; i++) {
+#if defined(ED25519_VERIFY_CACHE)
+		ed25519_verify_cache_clear();
+#endif
+		timeit(ed25519_split_verifier_sign_open(v, (unsigned char *)dataset[1].m, 1, dataset[1].pk, dataset[1].sig), splitticks)
+	}
+	printf("%.0f ticks/signature verification (split verifier)\n", (double)splitticks);
+	ed25519_split_verifier_destroy(v);
+}
+#endif
+
+#if defined(ED25519_NONCE_POOL)
+#if !defined(_WIN32)
+/* a forked child signs the same message as its parent, and must not get the parent's R */
+static void
+test_nonce_pool_fork(ed25519_nonce_pool *pool, int round) {
+	ed25519_signature sig, childsig;
+	int fds[2], status;
+	pid_t child;
+
+	edassert(pipe(fds) == 0, round, "failed to create pipe");
+	child = fork();
+	edassert(child >= 0, round, "failed to fork");
+	if (child == 0) {
+		ed25519_sign_pooled(pool, (unsigned char *)dataset[2].m, 2, sig);
+		_exit(((ed25519_nonce_pool_available(pool) == 0) && (write(fds[1], sig, 64) == 64)) ? 0 : 1);
+	}
+	ed25519_sign_pooled(pool, (unsigned char *)dataset[2].m, 2, sig);
+	edassert((waitpid(child, &status, 0) == child) && WIFEXITED(status) && (WEXITSTATUS(status) == 0), round, "forked child failed to sign");
+	edassert(read(fds[0], childsig, 64) == 64, round, "failed to read the child's signature");
+	close(fds[0]);
+	close(fds[1]);
+	edassert(!ed25519_sign_open((unsigned char *)dataset[2].m, 2, dataset[3].pk, childsig), round, "failed to open the child's pooled signature");
+	edassert(memcmp(sig, childsig, 32) != 0, round, "nonce pool reused a nonce across fork");
+}
+#endif
+
+/* pooled and online nonces both verify, and no R is handed out twice */
+static void
+test_nonce_pool(void) {
+	ed25519_nonce_pool *pool = ed25519_nonce_pool_create(dataset[3].sk, dataset[3].pk, 8), *other;
+	unsigned char sigs[24][64];
+	ed25519_signature sig;
+	size_t i, j;
+	uint64_t ticks, pooledticks = maxticks, fillticks = maxticks;
+
+	edassert(pool != NULL, 0, "failed to create nonce pool");
+	edassert(ed25519_nonce_pool_fill(pool, 5) == 5, 0, "nonce pool didn't fill");
+	edassert(ed25519_nonce_pool_fill(pool, 100) == 3, 0, "nonce pool filled past its capacity");
+	edassert(ed25519_nonce_pool_available(pool) == 8, 0, "nonce pool count is off");
+
+	/* 8 pooled, 8 online, then 8 more pooled */
+	for (i = 0; i < 24; i++) {
+		if (i == 16)
+			edassert(ed25519_nonce_pool_fill(pool, 8) == 8, (int)i, "nonce pool didn't refill");
+		ed25519_sign_pooled(pool, (unsigned char *)dataset[i].m, i, sigs[i]);
+		edassert(!ed25519_sign_open((unsigned char *)dataset[i].m, i, dataset[3].pk, sigs[i]), (int)i, "failed to open pooled signature");
+		for (j = 0; j < i; j++)
+			edassert(memcmp(sigs[i], sigs[j], 32) != 0, (int)i, "nonce pool reused a nonce");
+	}
+	edassert(ed25519_nonce_pool_available(pool) == 0, 0, "nonce pool count is off");
+
+	/* the same message under a second pool for the same key gets a fresh nonce */
+	other = ed25519_nonce_pool_create(dataset[3].sk, dataset[3].pk, 0);
+	edassert(other != NULL, 0, "failed to create nonce pool");
+	edassert(ed25519_nonce_pool_fill(other, 1) == 0, 0, "empty nonce pool took a nonce");
+	ed25519_sign_pooled(other, (unsigned char *)dataset[0].m, 0, sig);
+	edassert(!ed25519_sign_open((unsigned char *)dataset[0].m, 0, dataset[3].pk, sig), 0, "failed to open pooled signature");
+	edassert(memcmp(sig, sigs[0], 32) != 0, 0, "nonce pools shared a nonce");
+	ed25519_nonce_pool_destroy(other);
+
+#if !defined(_WIN32)
+	/* once with pooled entries to inherit, once with the online nonce */
+	edassert(ed25519_nonce_pool_fill(pool, 8) == 8, 0, "nonce pool didn't refill");
+	test_nonce_pool_fork(pool, 0);
+	while (ed25519_nonce_pool_available(pool))
+		ed25519_sign_pooled(pool, (unsigned char *)dataset[0].m, 0, sig);
+	test_nonce_pool_fork(pool, 1);
+#endif
+
+	for (i = 0; i < 256; i++) {
+		timeit(ed25519_nonce_pool_fill(pool, 1), fillticks)
+		timeit(ed25519_sign_pooled(pool, (unsigned char *)dataset[1].m, 1, sig), pooledticks)
+	}
+	printf("%.0f ticks/pooled nonce\n", (double)fillticks);
+	printf("%.0f ticks/signature (pooled nonce)\n", (double)pooledticks);
+	ed25519_nonce_pool_destroy(pool);
+}
+#endif
+
+#if defined(ED25519_COFACTORED)
+/*
+	signatures that only verify with the cofactor: keys offset by a point of order 8, and
+	a small order key with R = identity and S = 0. single, batch and prepared verification
+	must agree on all of them, and turn away S >= l
+*/
+static void
+test_cofactored(void) {
+	static const unsigned char order8[32] = {
+		0x26,0xe8,0x95,0x8f,0xc2,0xb2,0x27,0xb0,0x45,0xc3,0xf4,0x89,0xf2,0xef,0x98,0xf0,
+		0xd5,0xdf,0xac,0x05,0xd3,0xc6,0x33,0x39,0xb1,0x38,0x02,0x88,0x6d,0x53,0xfc,0x05
+	};
+	static const unsigned char l[32] = {
+		0xed,0xd3,0xf5,0x5c,0x1a,0x63,0x12,0x58,0xd6,0x9c,0xf7,0xa2,0xde,0xf9,0xde,0x14,
+		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10
+	};
+	static const unsigned char one[32] = {1}, four[32] = {4}, eight[32] = {8}, identity[32] = {1};
+	static unsigned char pks[64][32], sigs[64][64];
+	static ed25519_prepared_signature prepared[64];
+	const unsigned char *m[64], *pk[64], *RS[64], *e[2], *p[2];
+	size_t mlen[64], i, carry;
+	int valid[64], expected[64], single;
+	unsigned char out[32], sigl[64];
+
+	ed25519_scalarmult(out, eight, order8);
+	edassert_equal(identity, out, 32, "order 8 point isn't of order 8");
+	ed25519_scalarmult(out, four, order8);
+	edassert(memcmp(identity, out, 32) != 0, 0, "order 8 point is of order 4");
+
+	for (i = 0; i < 64; i++) {
+		m[i] = (unsigned char *)dataset[i].m;
+		mlen[i] = i;
+		expected[i] = 1;
+		if (i < 16) {
+			/* A + T, signed with the secret for A */
+			e[0] = one; e[1] = one;
+			p[0] = dataset[i].pk; p[1] = order8;
+			edassert(!ed25519_multi_scalarmult_vartime(pks[i], e, p, 2), (int)i, "failed to offset key");
+			ed25519_sign(m[i], mlen[i], dataset[i].sk, pks[i], sigs[i]);
+		} else if (i < 20) {
+			/* small order A, R = identity, S = 0 */
+			memcpy(pks[i], order8, 32);
+			memset(sigs[i], 0, 64);
+			sigs[i][0] = 1;
+		} else {
+			memcpy(pks[i], dataset[i].pk, 32);
+			memcpy(sigs[i], dataset[i].sig, 64);
+		}
+		pk[i] = pks[i];
+		RS[i] = sigs[i];
+	}
+
+	/* a forgery under an offset key, a plain forgery, and S + l */
+	sigs[5][40] ^= 1;
+	sigs[30][3] ^= 1;
+	for (i = 0, carry = 0; i < 32; i++) {
+		carry += (size_t)sigs[41][32 + i] + l[i];
+		sigs[41][32 + i] = (unsigned char)carry;
+		carry >>= 8;
+	}
+	expected[5] = expected[30] = expected[41] = 0;
+
+	for (i = 0; i < 64; i++) {
+		single = ed25519_sign_open(m[i], mlen[i], pk[i], RS[i]) ? 0 : 1;
+		edassert(single == expected[i], (int)i, "cofactored verification gave the wrong result");
+		ed25519_sign_open_prepare(m[i], mlen[i], pk[i], RS[i], &prepared[i]);
+		edassert((ed25519_sign_open_prepared(&prepared[i]) ? 0 : 1) == expected[i], (int)i, "cofactored prepared verification gave the wrong result");
+	}
+
+	ed25519_sign_open_batch(m, mlen, pk, RS, 64, valid);
+	for (i = 0; i < 64; i++)
+		edassert(valid[i] == expected[i], (int)i, "cofactored batch disagreed with single verification");
+	ed25519_sign_open_batch_prepared(prepared, 64, valid);
+	for (i = 0; i < 64; i++)
+		edassert(valid[i] == expected[i], (int)i, "cofactored prepared batch disagreed with single verification");
+
+	/* every signature valid, so the batch equation itself has to hold */
+	edassert(!ed25519_sign_open_batch(m + 42, mlen + 42, pk + 42, RS + 42, 22, valid), 0, "cofactored batch failed");
+	edassert(!ed25519_sign_open_batch(m, mlen, pk, RS, 5, valid), 0, "cofactored batch of offset keys failed");
+	edassert(!ed25519_sign_open_batch(m + 6, mlen + 6, pk + 6, RS + 6, 14, valid), 0, "cofactored batch of small order keys failed");
+
+	/* S + l as the only bad signature, so the batch equation is what sees it */
+	memcpy(sigl, sigs[50], 64);
+	for (i = 0, carry = 0; i < 32; i++) {
+		carry += (size_t)sigl[32 + i] + l[i];
+		sigl[32 + i] = (unsigned char)carry;
+		carry >>= 8;
+	}
+	RS[50] = sigl;
+	edassert(ed25519_sign_open(m[50], mlen[50], pk[50], RS[50]) != 0, 0, "cofactored verification opened S + l");
+	edassert(ed25519_sign_open_batch(m + 42, mlen + 42, pk + 42, RS + 42, 22, valid) == 1, 0, "cofactored batch opened S + l");
+	for (i = 0; i < 22; i++)
+		edassert(valid[i] == ((i + 42) != 50), (int)i, "cofactored batch disagreed with single verification on S + l");
 }
+#endif
 
 int
 main(void) {
 	test_main();
 	test_batch();
+	test_iovec();
+	test_sign_batch();
+	test_rfc8032();
+	test_batch_packed();
+	test_batch_context();
+	test_batch_accumulator();
+	test_sign_open_log();
+	test_prepared();
+#if defined(ED25519_KEY_CACHE) && !defined(ED25519_VERIFY_CACHE)
+	test_key_cache();
+#endif
+#if defined(ED25519_VERIFY_CACHE)
+	test_verify_cache();
+#endif
+#if defined(ED25519_VERIFY_SERVICE)
+	test_verify_service();
+	test_verify_service_priority();
+#endif
+#if defined(ED25519_SIGN_SERVICE)
+	test_sign_service();
+#endif
+#if defined(ED25519_SPLIT_VERIFY)
+	test_split_verify();
+#endif
+#if defined(ED25519_NONCE_POOL)
+	test_nonce_pool();
+#endif
+#if defined(ED25519_COFACTORED)
+	test_cofactored();
+#endif
 	return 0;
 }
 
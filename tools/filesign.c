@@ -0,0 +1,432 @@
+/*
+	filesign: sign and verify sets of files with detached signature manifests
+
+	filesign keygen secret-key-file
+	filesign sign [-t threads] secret-key-file manifest file..
+	filesign verify [-t threads] manifest
+
+	Keys are stored as hex. A manifest has one line per file, "pk sig path" with
+	pk and sig in hex, and the signature is plain Ed25519 over the file contents.
+	Files are mmapped, signed one per task and verified 64 per task with
+	ed25519_sign_open_batch, spread over a pool of threads.
+
+	exit status: 0 success, 1 a signature didn't verify, 3 an error
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../ed25519.h"
+
+#define verify_batch_size 64
+
+typedef struct mapped_file_t {
+	const unsigned char *data;
+	size_t size;
+} mapped_file;
+
+typedef struct manifest_entry_t {
+	ed25519_public_key pk;
+	ed25519_signature sig;
+	char *path;
+	int valid;
+} manifest_entry;
+
+typedef struct job_t {
+	manifest_entry *entries;
+	size_t count, next, tasks;
+	const unsigned char *sk;
+	ed25519_public_key pk;
+	int (*task)(struct job_t *job, size_t task);
+
+	pthread_mutex_t lock;
+	unsigned long long bytes;
+	size_t failed, errors;
+} job;
+
+static const unsigned char empty_file[1] = {0};
+
+static int
+map_file(mapped_file *f, const char *path) {
+	struct stat st;
+	void *p;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	f->size = (size_t)st.st_size;
+	f->data = empty_file;
+	if (f->size) {
+		p = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise(p, f->size, MADV_SEQUENTIAL);
+		f->data = (const unsigned char *)p;
+	}
+	close(fd);
+	return 0;
+}
+
+static void
+unmap_file(mapped_file *f) {
+	if (f->size)
+		munmap((void *)f->data, f->size);
+}
+
+static void
+to_hex(char *out, const unsigned char *in, size_t len) {
+	static const char digits[] = "0123456789abcdef";
+	size_t i;
+	for (i = 0; i < len; i++) {
+		out[i * 2 + 0] = digits[in[i] >> 4];
+		out[i * 2 + 1] = digits[in[i] & 15];
+	}
+	out[len * 2] = 0;
+}
+
+static int
+hex_digit(char c) {
+	if ((c >= '0') && (c <= '9')) return c - '0';
+	if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+	return -1;
+}
+
+static int
+from_hex(unsigned char *out, const char *in, size_t len) {
+	size_t i;
+	int hi, lo;
+	for (i = 0; i < len; i++) {
+		hi = hex_digit(in[i * 2 + 0]);
+		lo = hex_digit(in[i * 2 + 1]);
+		if ((hi < 0) || (lo < 0))
+			return -1;
+		out[i] = (unsigned char)((hi << 4) | lo);
+	}
+	return 0;
+}
+
+static double
+now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*
+	tasks are handed out in order from a shared counter
+*/
+
+static void *
+worker(void *arg) {
+	job *j = (job *)arg;
+	size_t task;
+
+	for (;;) {
+		pthread_mutex_lock(&j->lock);
+		task = j->next++;
+		pthread_mutex_unlock(&j->lock);
+		if (task >= j->tasks)
+			return NULL;
+		j->task(j, task);
+	}
+}
+
+static int
+run(job *j, size_t threadcount) {
+	pthread_t *threads = (pthread_t *)malloc(threadcount * sizeof(pthread_t));
+	size_t i, started;
+
+	if (!threads)
+		return -1;
+	for (started = 0; started < threadcount; started++)
+		if (pthread_create(&threads[started], NULL, worker, j) != 0)
+			break;
+	if (!started)
+		worker(j);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return 0;
+}
+
+static int
+sign_task(job *j, size_t task) {
+	manifest_entry *e = &j->entries[task];
+	mapped_file f;
+
+	if (map_file(&f, e->path) != 0) {
+		fprintf(stderr, "%s: %s\n", e->path, strerror(errno));
+		pthread_mutex_lock(&j->lock);
+		j->errors++;
+		pthread_mutex_unlock(&j->lock);
+		return -1;
+	}
+	memcpy(e->pk, j->pk, 32);
+	ed25519_sign(f.data, f.size, j->sk, j->pk, e->sig);
+	e->valid = 1;
+	unmap_file(&f);
+
+	pthread_mutex_lock(&j->lock);
+	j->bytes += f.size;
+	pthread_mutex_unlock(&j->lock);
+	return 0;
+}
+
+static int
+verify_task(job *j, size_t task) {
+	mapped_file f[verify_batch_size];
+	const unsigned char *m[verify_batch_size], *pk[verify_batch_size], *sig[verify_batch_size];
+	size_t mlen[verify_batch_size], index[verify_batch_size];
+	int valid[verify_batch_size];
+	manifest_entry *e = &j->entries[task * verify_batch_size];
+	size_t count = j->count - task * verify_batch_size, i, n, errors = 0;
+	unsigned long long bytes = 0;
+
+	if (count > verify_batch_size)
+		count = verify_batch_size;
+
+	/* files that can't be read are failures, the rest go in one batch */
+	for (i = 0, n = 0; i < count; i++) {
+		e[i].valid = 0;
+		if (map_file(&f[n], e[i].path) != 0) {
+			fprintf(stderr, "%s: %s\n", e[i].path, strerror(errno));
+			errors++;
+			continue;
+		}
+		index[n] = i;
+		m[n] = f[n].data;
+		mlen[n] = f[n].size;
+		pk[n] = e[i].pk;
+		sig[n] = e[i].sig;
+		bytes += f[n].size;
+		n++;
+	}
+
+	ed25519_sign_open_batch(m, mlen, pk, sig, n, valid);
+
+	for (i = 0; i < n; i++) {
+		e[index[i]].valid = valid[i];
+		unmap_file(&f[i]);
+	}
+
+	pthread_mutex_lock(&j->lock);
+	j->bytes += bytes;
+	j->errors += errors;
+	pthread_mutex_unlock(&j->lock);
+	return 0;
+}
+
+static void
+report(const char *what, size_t files, unsigned long long bytes, double seconds) {
+	if (seconds <= 0)
+		seconds = 1e-9;
+	fprintf(stderr, "%s %llu files, %.1f MB in %.3fs: %.0f files/s, %.1f MB/s, %.0f sigs/s\n",
+		what, (unsigned long long)files, (double)bytes / 1e6, seconds,
+		(double)files / seconds, (double)bytes / 1e6 / seconds, (double)files / seconds);
+}
+
+static int
+read_secret_key(ed25519_secret_key sk, const char *path) {
+	char hex[64 + 2];
+	FILE *f = fopen(path, "r");
+	int ok;
+
+	if (!f)
+		return -1;
+	ok = (fgets(hex, sizeof(hex), f) != NULL) && (strlen(hex) >= 64) && (from_hex(sk, hex, 32) == 0);
+	fclose(f);
+	return ok ? 0 : -1;
+}
+
+static int
+cmd_keygen(const char *path) {
+	ed25519_secret_key sk;
+	ed25519_public_key pk;
+	char hex[64 + 1];
+	FILE *f;
+	int fd;
+
+	if (!(f = fopen("/dev/urandom", "rb"))) {
+		fprintf(stderr, "/dev/urandom: %s\n", strerror(errno));
+		return 3;
+	}
+	fd = (fread(sk, 1, sizeof(sk), f) == sizeof(sk));
+	fclose(f);
+	if (!fd) {
+		fprintf(stderr, "/dev/urandom: short read\n");
+		return 3;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if ((fd < 0) || !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 3;
+	}
+	to_hex(hex, sk, 32);
+	fprintf(f, "%s\n", hex);
+	fclose(f);
+
+	ed25519_publickey(sk, pk);
+	to_hex(hex, pk, 32);
+	printf("%s\n", hex);
+	memset(sk, 0, sizeof(sk));
+	return 0;
+}
+
+static int
+cmd_sign(size_t threadcount, const char *skpath, const char *manifest, char **files, size_t count) {
+	ed25519_secret_key sk;
+	char pkhex[64 + 1], sighex[128 + 1];
+	double start;
+	FILE *out;
+	job j;
+	size_t i;
+
+	if (read_secret_key(sk, skpath) != 0) {
+		fprintf(stderr, "%s: unreadable secret key\n", skpath);
+		return 3;
+	}
+
+	memset(&j, 0, sizeof(j));
+	j.entries = (manifest_entry *)calloc(count ? count : 1, sizeof(manifest_entry));
+	if (!j.entries)
+		return 3;
+	for (i = 0; i < count; i++)
+		j.entries[i].path = files[i];
+	j.count = j.tasks = count;
+	j.sk = sk;
+	ed25519_publickey(sk, j.pk);
+	j.task = sign_task;
+	pthread_mutex_init(&j.lock, NULL);
+
+	start = now();
+	if (run(&j, threadcount) != 0)
+		return 3;
+	report("signed", count - j.errors, j.bytes, now() - start);
+	memset(sk, 0, sizeof(sk));
+
+	if (j.errors)
+		return 3;
+	if (!(out = fopen(manifest, "w"))) {
+		fprintf(stderr, "%s: %s\n", manifest, strerror(errno));
+		return 3;
+	}
+	to_hex(pkhex, j.pk, 32);
+	for (i = 0; i < count; i++) {
+		to_hex(sighex, j.entries[i].sig, 64);
+		fprintf(out, "%s %s %s\n", pkhex, sighex, j.entries[i].path);
+	}
+	fclose(out);
+	free(j.entries);
+	return 0;
+}
+
+static int
+cmd_verify(size_t threadcount, const char *manifest) {
+	manifest_entry *entries = NULL, *e;
+	size_t count = 0, allocated = 0, len, lineno = 0, i;
+	char line[4096 + 64 + 128 + 3];
+	double start;
+	FILE *in;
+	job j;
+
+	if (!(in = fopen(manifest, "r"))) {
+		fprintf(stderr, "%s: %s\n", manifest, strerror(errno));
+		return 3;
+	}
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		len = strlen(line);
+		while (len && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+			line[--len] = 0;
+		if (!len)
+			continue;
+		if (count == allocated) {
+			allocated = (allocated) ? allocated * 2 : 256;
+			if (!(e = (manifest_entry *)realloc(entries, allocated * sizeof(manifest_entry))))
+				return 3;
+			entries = e;
+		}
+		e = &entries[count];
+		if ((len < 64 + 1 + 128 + 2) || (line[64] != ' ') || (line[64 + 1 + 128] != ' ') ||
+			from_hex(e->pk, line, 32) || from_hex(e->sig, line + 64 + 1, 64)) {
+			fprintf(stderr, "%s:%llu: malformed line\n", manifest, (unsigned long long)lineno);
+			return 3;
+		}
+		if (!(e->path = strdup(line + 64 + 1 + 128 + 1)))
+			return 3;
+		count++;
+	}
+	fclose(in);
+
+	memset(&j, 0, sizeof(j));
+	j.entries = entries;
+	j.count = count;
+	j.tasks = (count + verify_batch_size - 1) / verify_batch_size;
+	j.task = verify_task;
+	pthread_mutex_init(&j.lock, NULL);
+
+	start = now();
+	if (run(&j, threadcount) != 0)
+		return 3;
+	report("verified", count - j.errors, j.bytes, now() - start);
+
+	for (i = 0; i < count; i++) {
+		if (!entries[i].valid) {
+			printf("FAILED %s\n", entries[i].path);
+			j.failed++;
+		}
+		free(entries[i].path);
+	}
+	free(entries);
+	return (j.errors) ? 3 : (j.failed) ? 1 : 0;
+}
+
+static void
+usage(void) {
+	fprintf(stderr,
+		"usage: filesign keygen secret-key-file\n"
+		"       filesign sign [-t threads] secret-key-file manifest file..\n"
+		"       filesign verify [-t threads] manifest\n");
+	exit(3);
+}
+
+int
+main(int argc, char **argv) {
+	size_t threadcount = 0;
+	int arg = 2;
+
+	if (argc < 3)
+		usage();
+	if ((argc > 4) && !strcmp(argv[2], "-t")) {
+		threadcount = (size_t)strtoul(argv[3], NULL, 10);
+		arg = 4;
+	}
+	if (!threadcount)
+		threadcount = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+	if (!threadcount)
+		threadcount = 1;
+
+	if (!strcmp(argv[1], "keygen") && (argc == 3))
+		return cmd_keygen(argv[2]);
+	if (!strcmp(argv[1], "sign") && ((argc - arg) >= 2))
+		return cmd_sign(threadcount, argv[arg], argv[arg + 1], argv + arg + 2, (size_t)(argc - arg - 2));
+	if (!strcmp(argv[1], "verify") && ((argc - arg) == 1))
+		return cmd_verify(threadcount, argv[arg]);
+	usage();
+	return 3;
+}
@@ -0,0 +1,313 @@
+/*
+	logverify: verify an append-only log of signed records in parallel
+
+	logverify [-t threads] [-c checkpoint] log
+
+	Records are pk[32] || sig[64] || mlen[4] (little endian) || m[mlen], see
+	ed25519_sign_open_log. The log is mmapped and handed out in chunks of whole
+	records, in order, to threads which batch verify them in place. The chunk
+	after each one handed out is hinted to the kernel for read-ahead.
+
+	With -c, the length of the verified prefix is kept in the checkpoint file as
+	it grows, and a later run starts from it.
+
+	exit status: 0 every record verified, 1 an invalid record, 2 a partial
+	record at the end, 3 an error
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../ed25519.h"
+
+#define log_header_size (32 + 64 + 4)
+#define chunk_target_size ((size_t)4 << 20)
+#define checkpoint_interval ((unsigned long long)256 << 20)
+
+enum chunk_state_t {
+	chunk_pending = 0,
+	chunk_valid = 1,
+	chunk_invalid = 2
+};
+
+typedef struct logverify_t {
+	const unsigned char *log;
+	size_t size, page;
+	const char *checkpoint;
+	pthread_mutex_t lock;
+
+	/* chunks handed out so far */
+	size_t cursor, chunks, allocated;
+	size_t *chunk_end, *chunk_records;
+	unsigned char *chunk_state;
+
+	/* chunks verified, contiguous from the first */
+	size_t completed, prefix, records, checkpointed;
+	size_t invalid;
+	int stopped, error;
+} logverify;
+
+static int
+checkpoint_read(const char *path, size_t *offset) {
+	unsigned long long v;
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return (errno == ENOENT) ? 0 : -1;
+	if (fscanf(f, "%llu", &v) != 1) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	*offset = (size_t)v;
+	return 0;
+}
+
+/* written to path.tmp and renamed over path, so a crash leaves the old or the new checkpoint */
+static int
+checkpoint_write(const char *path, size_t offset) {
+	char tmp[4096];
+	FILE *f;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -1;
+	if (!(f = fopen(tmp, "w")))
+		return -1;
+	fprintf(f, "%llu\n", (unsigned long long)offset);
+	if (fflush(f) || fsync(fileno(f))) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return rename(tmp, path);
+}
+
+static void
+readahead_hint(logverify *lv, size_t start, size_t len) {
+	size_t aligned = start & ~(lv->page - 1);
+	if (start >= lv->size)
+		return;
+	if (len > (lv->size - start))
+		len = lv->size - start;
+	madvise((void *)(lv->log + aligned), len + (start - aligned), MADV_WILLNEED);
+}
+
+static size_t
+record_mlen(const unsigned char *record) {
+	const unsigned char *h = record + 96;
+	return (size_t)h[0] | ((size_t)h[1] << 8) | ((size_t)h[2] << 16) | ((size_t)h[3] << 24);
+}
+
+static int
+chunk_grow(logverify *lv) {
+	size_t allocated = (lv->allocated) ? lv->allocated * 2 : 1024;
+	size_t *chunk_end, *chunk_records;
+	unsigned char *chunk_state;
+
+	if (!(chunk_end = (size_t *)realloc(lv->chunk_end, allocated * sizeof(size_t))))
+		return 0;
+	lv->chunk_end = chunk_end;
+	if (!(chunk_records = (size_t *)realloc(lv->chunk_records, allocated * sizeof(size_t))))
+		return 0;
+	lv->chunk_records = chunk_records;
+	if (!(chunk_state = (unsigned char *)realloc(lv->chunk_state, allocated)))
+		return 0;
+	lv->chunk_state = chunk_state;
+	memset(lv->chunk_state + lv->allocated, chunk_pending, allocated - lv->allocated);
+	lv->allocated = allocated;
+	return 1;
+}
+
+/* the next chunk of whole records, 0 when there are none left. called with the lock held */
+static int
+chunk_next(logverify *lv, size_t *index, size_t *start, size_t *end) {
+	size_t offset = lv->cursor, records = 0, mlen;
+
+	if ((lv->cursor >= lv->invalid) || lv->error)
+		return 0;
+
+	while ((offset - lv->cursor) < chunk_target_size) {
+		if ((lv->size - offset) < log_header_size)
+			break;
+		mlen = record_mlen(lv->log + offset);
+		if ((lv->size - offset - log_header_size) < mlen)
+			break;
+		offset += log_header_size + mlen;
+		records++;
+	}
+	if (!records)
+		return 0;
+
+	if ((lv->chunks == lv->allocated) && !chunk_grow(lv)) {
+		lv->error = 1;
+		return 0;
+	}
+
+	*index = lv->chunks++;
+	*start = lv->cursor;
+	*end = offset;
+	lv->chunk_end[*index] = offset;
+	lv->chunk_records[*index] = records;
+	lv->cursor = offset;
+
+	/* start reading the chunk after this one while it is verified */
+	readahead_hint(lv, offset, chunk_target_size);
+	return 1;
+}
+
+/* records the result of a chunk and advances the verified prefix. called with the lock held */
+static void
+chunk_done(logverify *lv, size_t index, size_t start, int valid, size_t verified) {
+	size_t offset;
+
+	if (valid) {
+		lv->chunk_state[index] = chunk_valid;
+	} else {
+		/* the chunk now ends at the invalid record, and holds the records before it */
+		lv->chunk_state[index] = chunk_invalid;
+		lv->chunk_end[index] = start + verified;
+		lv->chunk_records[index] = 0;
+		for (offset = start; offset < (start + verified); offset += log_header_size + record_mlen(lv->log + offset))
+			lv->chunk_records[index]++;
+		if ((start + verified) < lv->invalid)
+			lv->invalid = start + verified;
+	}
+
+	/* the prefix stops for good at the first invalid record */
+	while (!lv->stopped && (lv->completed < lv->chunks) && (lv->chunk_state[lv->completed] != chunk_pending)) {
+		lv->prefix = lv->chunk_end[lv->completed];
+		lv->records += lv->chunk_records[lv->completed];
+		lv->stopped = (lv->chunk_state[lv->completed] == chunk_invalid);
+		lv->completed++;
+	}
+
+	if (lv->checkpoint && ((unsigned long long)(lv->prefix - lv->checkpointed) >= checkpoint_interval)) {
+		if (checkpoint_write(lv->checkpoint, lv->prefix) == 0)
+			lv->checkpointed = lv->prefix;
+	}
+}
+
+static void *
+worker(void *arg) {
+	logverify *lv = (logverify *)arg;
+	size_t index, start, end, verified;
+	int valid;
+
+	for (;;) {
+		pthread_mutex_lock(&lv->lock);
+		if (!chunk_next(lv, &index, &start, &end)) {
+			pthread_mutex_unlock(&lv->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&lv->lock);
+
+		valid = (ed25519_sign_open_log(lv->log + start, end - start, &verified) == 0);
+
+		pthread_mutex_lock(&lv->lock);
+		chunk_done(lv, index, start, valid, verified);
+		pthread_mutex_unlock(&lv->lock);
+	}
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: logverify [-t threads] [-c checkpoint] log\n");
+	exit(3);
+}
+
+int
+main(int argc, char **argv) {
+	logverify lv;
+	const char *path = NULL;
+	pthread_t *threads;
+	size_t threadcount = 0, i, start = 0;
+	struct stat st;
+	void *map;
+	int fd, arg;
+
+	memset(&lv, 0, sizeof(lv));
+	for (arg = 1; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "-t") && ((arg + 1) < argc))
+			threadcount = (size_t)strtoul(argv[++arg], NULL, 10);
+		else if (!strcmp(argv[arg], "-c") && ((arg + 1) < argc))
+			lv.checkpoint = argv[++arg];
+		else if (!path && (argv[arg][0] != '-'))
+			path = argv[arg];
+		else
+			usage();
+	}
+	if (!path)
+		usage();
+	if (!threadcount)
+		threadcount = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+	if (!threadcount)
+		threadcount = 1;
+
+	if (((fd = open(path, O_RDONLY)) < 0) || (fstat(fd, &st) != 0)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 3;
+	}
+	lv.size = (size_t)st.st_size;
+	lv.page = (size_t)sysconf(_SC_PAGESIZE);
+
+	if (lv.checkpoint && (checkpoint_read(lv.checkpoint, &start) != 0)) {
+		fprintf(stderr, "%s: unreadable checkpoint\n", lv.checkpoint);
+		return 3;
+	}
+	if (start > lv.size) {
+		fprintf(stderr, "%s: checkpoint at %llu is past the end of the log\n", lv.checkpoint, (unsigned long long)start);
+		return 3;
+	}
+
+	if (start < lv.size) {
+		map = mmap(NULL, lv.size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return 3;
+		}
+		lv.log = (const unsigned char *)map;
+		madvise(map, lv.size, MADV_SEQUENTIAL);
+	}
+
+	lv.cursor = lv.prefix = lv.checkpointed = start;
+	lv.invalid = lv.size;
+	pthread_mutex_init(&lv.lock, NULL);
+
+	threads = (pthread_t *)malloc(threadcount * sizeof(pthread_t));
+	if (!threads)
+		return 3;
+	for (i = 0; i < threadcount; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &lv) != 0) {
+			fprintf(stderr, "failed to start thread %llu\n", (unsigned long long)i);
+			return 3;
+		}
+	}
+	for (i = 0; i < threadcount; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if (lv.error) {
+		fprintf(stderr, "out of memory\n");
+		return 3;
+	}
+	if (lv.checkpoint && (lv.prefix != lv.checkpointed) && (checkpoint_write(lv.checkpoint, lv.prefix) != 0)) {
+		fprintf(stderr, "%s: %s\n", lv.checkpoint, strerror(errno));
+		return 3;
+	}
+
+	printf("verified %llu records, bytes %llu..%llu\n", (unsigned long long)lv.records, (unsigned long long)start, (unsigned long long)lv.prefix);
+	if (lv.invalid < lv.size) {
+		printf("invalid record at offset %llu\n", (unsigned long long)lv.invalid);
+		return 1;
+	}
+	if (lv.prefix < lv.size) {
+		printf("partial record at offset %llu\n", (unsigned long long)lv.prefix);
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+	verifyd client, see verifyd-client.h
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "verifyd-client.h"
+
+static void
+verifyd_u32_write(unsigned char *p, uint32_t v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t
+verifyd_u32_read(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int
+verifyd_connect(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int
+verifyd_send(int fd, uint32_t id, const unsigned char *m, size_t mlen, const unsigned char pk[32], const unsigned char sig[64]) {
+	unsigned char header[VERIFYD_REQUEST_HEADER_SIZE];
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t n;
+
+	if (mlen > 0xffffffff)
+		return -1;
+	verifyd_u32_write(header, id);
+	verifyd_u32_write(header + 4, (uint32_t)mlen);
+	memcpy(header + 8, pk, 32);
+	memcpy(header + 40, sig, 64);
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = (void *)m;
+	iov[1].iov_len = mlen;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	/* header and message in one call, the rest after a short write */
+	while (msg.msg_iovlen) {
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (msg.msg_iovlen && ((size_t)n >= msg.msg_iov[0].iov_len)) {
+			n -= (ssize_t)msg.msg_iov[0].iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen) {
+			msg.msg_iov[0].iov_base = (unsigned char *)msg.msg_iov[0].iov_base + n;
+			msg.msg_iov[0].iov_len -= (size_t)n;
+		}
+	}
+	return 0;
+}
+
+int
+verifyd_recv(int fd, uint32_t *id, int *valid) {
+	unsigned char response[VERIFYD_RESPONSE_SIZE];
+	size_t have = 0;
+	ssize_t n;
+
+	while (have < sizeof(response)) {
+		n = read(fd, response + have, sizeof(response) - have);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			return -1;
+		have += (size_t)n;
+	}
+	*id = verifyd_u32_read(response);
+	*valid = (response[4] == 1);
+	return 0;
+}
+
+int
+verifyd_sign_open(int fd, const unsigned char *m, size_t mlen, const unsigned char pk[32], const unsigned char sig[64]) {
+	uint32_t id;
+	int valid;
+
+	if ((verifyd_send(fd, 0, m, mlen, pk, sig) != 0) || (verifyd_recv(fd, &id, &valid) != 0))
+		return -2;
+	return valid ? 0 : -1;
+}
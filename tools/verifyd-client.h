@@ -0,0 +1,45 @@
+/*
+	verifyd client
+
+	Requests and responses are little endian and pipelined on one stream, in
+	any number:
+
+		request:  id[4] || mlen[4] || pk[32] || sig[64] || m[mlen]
+		response: id[4] || valid[1] || reserved[3]
+
+	Responses come back in the order signatures finish, not the order they
+	were sent, and carry the id of their request. A request with mlen over the
+	daemon's limit closes the connection, as does letting unread responses
+	fill the socket buffer, so pipelining clients read as they send.
+*/
+
+#ifndef VERIFYD_CLIENT_H
+#define VERIFYD_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define VERIFYD_REQUEST_HEADER_SIZE (4 + 4 + 32 + 64)
+#define VERIFYD_RESPONSE_SIZE 8
+
+/* a connected socket, -1 on failure */
+int verifyd_connect(const char *path);
+
+/* 0 once the whole request is written, -1 on failure */
+int verifyd_send(int fd, uint32_t id, const unsigned char *m, size_t mlen, const unsigned char pk[32], const unsigned char sig[64]);
+
+/* 0 and the next response, -1 on failure or when the daemon closed the connection */
+int verifyd_recv(int fd, uint32_t *id, int *valid);
+
+/* one request and its response, with no others outstanding on fd. 0 if valid, -1 if not, -2 on failure */
+int verifyd_sign_open(int fd, const unsigned char *m, size_t mlen, const unsigned char pk[32], const unsigned char sig[64]);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* VERIFYD_CLIENT_H */
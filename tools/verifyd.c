@@ -0,0 +1,320 @@
+/*
+	verifyd: a signature verification daemon for the processes on one host
+
+	verifyd [-t threads] [-l latency_us] [-q queue] [-m max_message] socket
+
+	Clients connect to the UNIX socket and pipeline requests framed as in
+	verifyd-client.h. Requests from every client go to a single
+	ed25519_verify_service, so batches fill across clients, and with
+	ED25519_KEY_CACHE one key cache is shared by all of them. Workers write each
+	response as soon as its batch is done. Access to the daemon is controlled
+	by the permissions of the directory holding the socket.
+
+	SIGINT or SIGTERM stop accepting requests, finish the ones in flight and
+	remove the socket.
+
+	build ed25519.c with -DED25519_VERIFY_SERVICE, and -DED25519_KEY_CACHE for the
+	shared key cache
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../ed25519.h"
+#include "verifyd-client.h"
+
+#define read_size ((size_t)64 << 10)
+
+typedef struct client_t {
+	int fd;
+	pthread_mutex_t lock; /* held for writes and refs */
+	size_t refs;
+	int closed;
+	unsigned char *in;
+	size_t have, allocated;
+} client;
+
+typedef struct request_t {
+	client *c;
+	uint32_t id;
+	unsigned char pk[32], sig[64];
+	size_t mlen;
+	unsigned char m[1];
+} request;
+
+static volatile sig_atomic_t stopping = 0;
+static unsigned long long requests, invalid;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+on_signal(int sig) {
+	(void)sig;
+	stopping = 1;
+}
+
+static uint32_t
+u32_read(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void
+client_release(client *c) {
+	size_t refs;
+
+	pthread_mutex_lock(&c->lock);
+	refs = --c->refs;
+	pthread_mutex_unlock(&c->lock);
+	if (refs)
+		return;
+	close(c->fd);
+	pthread_mutex_destroy(&c->lock);
+	free(c->in);
+	free(c);
+}
+
+/* a client that stops reading loses its connection rather than a worker */
+static void
+respond(client *c, uint32_t id, int valid) {
+	unsigned char response[VERIFYD_RESPONSE_SIZE];
+	size_t sent = 0;
+	ssize_t n;
+
+	response[0] = (unsigned char)id;
+	response[1] = (unsigned char)(id >> 8);
+	response[2] = (unsigned char)(id >> 16);
+	response[3] = (unsigned char)(id >> 24);
+	response[4] = (unsigned char)(valid ? 1 : 0);
+	response[5] = response[6] = response[7] = 0;
+
+	pthread_mutex_lock(&c->lock);
+	while (!c->closed && (sent < sizeof(response))) {
+		n = send(c->fd, response + sent, sizeof(response) - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n > 0) {
+			sent += (size_t)n;
+		} else if ((n < 0) && (errno == EINTR)) {
+			continue;
+		} else {
+			c->closed = 1;
+			shutdown(c->fd, SHUT_RDWR);
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	pthread_mutex_lock(&stats_lock);
+	requests++;
+	invalid += valid ? 0 : 1;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void
+request_done(void *arg, void *tag, int valid) {
+	request *r = (request *)tag;
+	(void)arg;
+	respond(r->c, r->id, valid);
+	client_release(r->c);
+	free(r);
+}
+
+/* hands every whole request in c's buffer to the service, 0 if c sent an oversized one */
+static int
+client_parse(ed25519_verify_service *svc, client *c, size_t max_message) {
+	size_t offset = 0, mlen;
+	request *r;
+
+	while ((c->have - offset) >= VERIFYD_REQUEST_HEADER_SIZE) {
+		mlen = u32_read(c->in + offset + 4);
+		if (mlen > max_message)
+			return 0;
+		if ((c->have - offset - VERIFYD_REQUEST_HEADER_SIZE) < mlen)
+			break;
+
+		if (!(r = (request *)malloc(sizeof(request) + mlen)))
+			return 0;
+		r->c = c;
+		r->id = u32_read(c->in + offset);
+		memcpy(r->pk, c->in + offset + 8, 32);
+		memcpy(r->sig, c->in + offset + 40, 64);
+		memcpy(r->m, c->in + offset + VERIFYD_REQUEST_HEADER_SIZE, mlen);
+		r->mlen = mlen;
+		offset += VERIFYD_REQUEST_HEADER_SIZE + mlen;
+
+		pthread_mutex_lock(&c->lock);
+		c->refs++;
+		pthread_mutex_unlock(&c->lock);
+
+		/* with the queue full the request is verified here, which also slows the client down */
+		if (ed25519_verify_service_submit(svc, r->m, r->mlen, r->pk, r->sig, request_done, NULL, r) != 0)
+			request_done(NULL, r, ed25519_sign_open(r->m, r->mlen, r->pk, r->sig) == 0);
+	}
+
+	memmove(c->in, c->in + offset, c->have - offset);
+	c->have -= offset;
+	return 1;
+}
+
+/* 0 when c is finished with */
+static int
+client_read(ed25519_verify_service *svc, client *c, size_t max_message) {
+	size_t want = c->have + read_size;
+	unsigned char *in;
+	ssize_t n;
+
+	if (want > c->allocated) {
+		if (!(in = (unsigned char *)realloc(c->in, want)))
+			return 0;
+		c->in = in;
+		c->allocated = want;
+	}
+
+	n = read(c->fd, c->in + c->have, c->allocated - c->have);
+	if (n < 0)
+		return (errno == EINTR) || (errno == EAGAIN);
+	if (n == 0)
+		return 0;
+	c->have += (size_t)n;
+	return client_parse(svc, c, max_message);
+}
+
+static int
+listen_on(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* a socket left behind by an earlier run */
+	unlink(path);
+	if (((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, 128) != 0)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return fd;
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: verifyd [-t threads] [-l latency_us] [-q queue] [-m max_message] socket\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv) {
+	const char *path = NULL;
+	size_t threads = 0, queue = 65536, max_message = (size_t)1 << 20;
+	unsigned long latency = 200;
+	ed25519_verify_service *svc;
+	struct pollfd *fds = NULL;
+	client **clients = NULL, *c;
+	size_t count = 1, allocated = 0, i;
+	struct sigaction sa;
+	int listener, fd, arg;
+
+	for (arg = 1; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "-t") && ((arg + 1) < argc))
+			threads = (size_t)strtoul(argv[++arg], NULL, 10);
+		else if (!strcmp(argv[arg], "-l") && ((arg + 1) < argc))
+			latency = strtoul(argv[++arg], NULL, 10);
+		else if (!strcmp(argv[arg], "-q") && ((arg + 1) < argc))
+			queue = (size_t)strtoul(argv[++arg], NULL, 10);
+		else if (!strcmp(argv[arg], "-m") && ((arg + 1) < argc))
+			max_message = (size_t)strtoul(argv[++arg], NULL, 10);
+		else if (!path && (argv[arg][0] != '-'))
+			path = argv[arg];
+		else
+			usage();
+	}
+	if (!path)
+		usage();
+	if (!threads)
+		threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+	if (!threads)
+		threads = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if ((listener = listen_on(path)) < 0)
+		return 1;
+	if (!(svc = ed25519_verify_service_create(threads, queue, latency))) {
+		fprintf(stderr, "failed to start the verify service\n");
+		return 1;
+	}
+
+	/* fds[0] is the listener, fds[i] belongs to clients[i] */
+	while (!stopping) {
+		if (count >= allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			fds = (struct pollfd *)realloc(fds, allocated * sizeof(struct pollfd));
+			clients = (client **)realloc(clients, allocated * sizeof(client *));
+			if (!fds || !clients) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+		}
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (i = 1; i < count; i++) {
+			fds[i].fd = clients[i]->fd;
+			fds[i].events = POLLIN;
+		}
+
+		/* the timeout catches a signal that lands just before poll */
+		if (poll(fds, count, 1000) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			break;
+		}
+
+		for (i = count; i-- > 1; ) {
+			if (!fds[i].revents)
+				continue;
+			if (client_read(svc, clients[i], max_message))
+				continue;
+			/* the service may still hold requests from it */
+			pthread_mutex_lock(&clients[i]->lock);
+			clients[i]->closed = 1;
+			pthread_mutex_unlock(&clients[i]->lock);
+			client_release(clients[i]);
+			clients[i] = clients[--count];
+		}
+
+		if ((fds[0].revents & POLLIN) && ((fd = accept(listener, NULL, NULL)) >= 0)) {
+			if (!(c = (client *)calloc(1, sizeof(client)))) {
+				close(fd);
+				continue;
+			}
+			c->fd = fd;
+			c->refs = 1;
+			pthread_mutex_init(&c->lock, NULL);
+			clients[count++] = c;
+		}
+	}
+
+	/* answer what is in flight, then hang up */
+	ed25519_verify_service_destroy(svc);
+	for (i = 1; i < count; i++)
+		client_release(clients[i]);
+	close(listener);
+	unlink(path);
+	free(fds);
+	free(clients);
+
+	fprintf(stderr, "verified %llu signatures, %llu invalid\n", requests, invalid);
+	return 0;
+}